@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+#define STRING_SLAB_SIZE 65536
+
+static ArenaSlab* new_slab(size_t size) {
+    ArenaSlab* slab = malloc(sizeof(ArenaSlab) + size);
+    if (!slab) {
+        perror("Failed to allocate memory for arena slab");
+        exit(EXIT_FAILURE);
+    }
+    slab->next = NULL;
+    slab->size = size;
+    return slab;
+}
+
+static void enter_slab(NodeArena* arena, ArenaSlab* slab) {
+    arena->current = slab;
+    arena->next = (char*)(slab + 1);
+    arena->end = arena->next + slab->size;
+}
+
+void* arena_alloc(NodeArena* arena) {
+    void* block;
+
+    // Reuse released blocks first
+    if (arena->free_list) {
+        block = arena->free_list;
+        arena->free_list = *(void**)block;
+    } else {
+        if (arena->next == arena->end) {
+            if (arena->current && arena->current->next) {
+                // Slabs kept from before the last reset
+                enter_slab(arena, arena->current->next);
+            } else {
+                ArenaSlab* slab = new_slab(arena->block_size * arena->slab_blocks);
+                if (arena->current) arena->current->next = slab;
+                else arena->slabs = slab;
+                enter_slab(arena, slab);
+            }
+        }
+        block = arena->next;
+        arena->next += arena->block_size;
+    }
+
+    arena->live++;
+    arena->allocated++;
+    if (arena->live > arena->peak) arena->peak = arena->live;
+    return block;
+}
+
+void arena_release(NodeArena* arena, void* block) {
+    *(void**)block = arena->free_list;
+    arena->free_list = block;
+    arena->live--;
+}
+
+void arena_reset(NodeArena* arena) {
+    arena->free_list = NULL;
+    arena->live = 0;
+    if (arena->slabs) enter_slab(arena, arena->slabs);
+}
+
+void arena_free(NodeArena* arena) {
+    ArenaSlab* slab = arena->slabs;
+    while (slab) {
+        ArenaSlab* next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    arena->slabs = NULL;
+    arena->current = NULL;
+    arena->next = arena->end = NULL;
+    arena->free_list = NULL;
+    arena->live = 0;
+}
+
+char* string_arena_copy(StringArena* arena, const char* str, size_t len) {
+    if ((size_t)(arena->end - arena->next) < len + 1) {
+        // Long names get a slab of their own
+        size_t size = len + 1 > STRING_SLAB_SIZE ? len + 1 : STRING_SLAB_SIZE;
+        ArenaSlab* slab = new_slab(size);
+        slab->next = arena->slabs;
+        arena->slabs = slab;
+        arena->next = (char*)(slab + 1);
+        arena->end = arena->next + size;
+    }
+
+    char* copy = arena->next;
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    arena->next += len + 1;
+    return copy;
+}
+
+void string_arena_free(StringArena* arena) {
+    ArenaSlab* slab = arena->slabs;
+    while (slab) {
+        ArenaSlab* next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    memset(arena, 0, sizeof(StringArena));
+}
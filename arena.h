@@ -0,0 +1,51 @@
+#ifndef ARENA
+#define ARENA
+
+#include <stddef.h>
+
+/*One malloc'd chunk of an arena*/
+typedef struct ArenaSlab {
+    struct ArenaSlab* next;
+    size_t size; // Usable bytes after the header
+} ArenaSlab;
+
+/*Slab allocator of fixed size blocks, released blocks are reused before new ones are taken*/
+typedef struct NodeArena {
+    size_t block_size; // Size of every block handed out
+    size_t slab_blocks; // Number of blocks in every slab
+    ArenaSlab* slabs; // All slabs, kept on reset so the memory is reused
+    ArenaSlab* current; // Slab the bump pointer is in
+    char* next; // Next unused block in the current slab
+    char* end;
+    void* free_list; // Blocks given back with arena_release
+    size_t live; // Blocks currently in use
+    size_t peak; // Most blocks in use at once
+    size_t allocated; // Blocks handed out since the arena was made, reused ones included
+} NodeArena;
+
+/*Arena for strings that are only released all together*/
+typedef struct StringArena {
+    ArenaSlab* slabs;
+    char* next;
+    char* end;
+} StringArena;
+
+/*Get a block from the arena*/
+void* arena_alloc(NodeArena* arena);
+
+/*Give a single block back to the arena*/
+void arena_release(NodeArena* arena, void* block);
+
+/*Release every block of the arena at once, the slabs stay allocated*/
+void arena_reset(NodeArena* arena);
+
+/*Free all slabs of the arena*/
+void arena_free(NodeArena* arena);
+
+/*Copy len characters and a null terminator into the string arena*/
+char* string_arena_copy(StringArena* arena, const char* str, size_t len);
+
+/*Free all strings of the arena*/
+void string_arena_free(StringArena* arena);
+
+#endif
@@ -0,0 +1,356 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "lambda_calc.h"
+#include "snapshot.h"
+#include "delta.h"
+#include "compact.h"
+#include "stats.h"
+
+/*Kinds of work a workload measures*/
+#define BENCH_PARSE 0
+#define BENCH_REDUCE 1
+#define BENCH_EXPAND 2
+#define BENCH_CONTRACT 3
+#define BENCH_LOAD 4 // Reads the prelude into a new table
+#define BENCH_RESTORE 5 // Restores a snapshot of the prelude into a new table
+#define BENCH_DELTA 6 // Reduces with the arithmetic of the prelude bound to builtins
+#define BENCH_COMPACT 7 // Reduces like BENCH_REDUCE on the index based store
+#define BENCH_LAZY 8 // Reduces the unexpanded term, definitions unfold when they are reached
+#define BENCH_PRINT 9 // Prints the expanded term to /dev/null
+
+/*Generated terms replacing the term of a workload*/
+#define INPUT_NONE 0
+#define INPUT_DEEP 1 // Church numeral applied size times
+#define INPUT_DEFS 2 // Application of size definitions that are added to the table
+
+/*One benchmark, every timed pass starts again from the parsed term*/
+typedef struct Workload {
+    const char* name;
+    int kind;
+    const char* term;
+    int input;
+    int size;
+    int repeat;
+} Workload;
+
+static const Workload workloads[] = {
+    {"church_add", BENCH_REDUCE, "((add ((mul three)three))((mul three)three))", INPUT_NONE, 0, 2000},
+    {"church_mul", BENCH_REDUCE, "((mul ((mul three)three))((mul three)three))", INPUT_NONE, 0, 200},
+    {"church_pow", BENCH_REDUCE, "((pow two)((add three)three))", INPUT_NONE, 0, 500},
+    {"church_sub", BENCH_REDUCE, "((sub ((mul three)three))three)", INPUT_NONE, 0, 500},
+    {"factorial_y", BENCH_REDUCE, "(fact three)", INPUT_NONE, 0, 200},
+    {"fibonacci_y", BENCH_REDUCE, "(fib ((add three)three))", INPUT_NONE, 0, 20},
+    {"factorial_delta", BENCH_DELTA, "(fact three)", INPUT_NONE, 0, 200},
+    {"fibonacci_delta", BENCH_DELTA, "(fib ((add three)three))", INPUT_NONE, 0, 20},
+    {"church_mul_compact", BENCH_COMPACT, "((mul ((mul three)three))((mul three)three))", INPUT_NONE, 0, 200},
+    {"factorial_compact", BENCH_COMPACT, "(fact three)", INPUT_NONE, 0, 200},
+    {"fibonacci_compact", BENCH_COMPACT, "(fib ((add three)three))", INPUT_NONE, 0, 20},
+    {"factorial_lazy", BENCH_LAZY, "(fact three)", INPUT_NONE, 0, 200},
+    {"fibonacci_lazy", BENCH_LAZY, "(fib ((add three)three))", INPUT_NONE, 0, 20},
+    {"ackermann", BENCH_REDUCE, "((ack two)three)", INPUT_NONE, 0, 500},
+    {"parse_deep", BENCH_PARSE, NULL, INPUT_DEEP, 100000, 10},
+    {"parse_prelude", BENCH_PARSE, "(fib(fact((ack((pow two)three))((sub((mul three)two))one))))", INPUT_NONE, 0, 100000},
+    {"expand_prelude", BENCH_EXPAND, "((fib(fact three))((ack two)((pow two)three)))", INPUT_NONE, 0, 20000},
+    {"contract_table", BENCH_CONTRACT, NULL, INPUT_DEFS, 2000, 50},
+    {"load_prelude", BENCH_LOAD, NULL, INPUT_NONE, 0, 2000},
+    {"restore_prelude", BENCH_RESTORE, NULL, INPUT_NONE, 0, 2000},
+    {"print_deep", BENCH_PRINT, NULL, INPUT_DEEP, 100000, 50},
+    {"print_prelude", BENCH_PRINT, "((fib(fact three))((ack two)((pow two)three)))", INPUT_NONE, 0, 20000},
+};
+
+/*Measurements a workload sends back to the driver*/
+typedef struct BenchResult {
+    double seconds;
+    unsigned long long reductions;
+    unsigned long long operations; // Parses, expansion passes, contraction passes or prints
+    unsigned long long tokens; // Tokens allocated while timed
+    unsigned int result_hash; // Hash of the last result, changes when the result does
+    int failed;
+} BenchResult;
+
+static double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static char* grow_text(char* text, size_t* length, size_t* capacity, const char* part) {
+    size_t part_length = strlen(part);
+    if (*length + part_length + 1 > *capacity) {
+        *capacity = (*length + part_length + 1) * 2;
+        text = realloc(text, *capacity);
+        if (!text) {
+            perror("Failed to allocate memory for bench input");
+            exit(EXIT_FAILURE);
+        }
+    }
+    memcpy(text + *length, part, part_length + 1);
+    *length += part_length;
+    return text;
+}
+
+/*Builds the term of a generated input, the definitions it uses are added to the table*/
+static char* generate_input(const Workload* workload, HashTable* table) {
+    char* text = NULL;
+    size_t length = 0;
+    size_t capacity = 0;
+    char part[64];
+    text = grow_text(text, &length, &capacity, "");
+
+    if (workload->input == INPUT_DEEP) {
+        text = grow_text(text, &length, &capacity, "(\\f.(\\x.");
+        for (int i = 0; i < workload->size; i++) text = grow_text(text, &length, &capacity, "(f");
+        text = grow_text(text, &length, &capacity, " x");
+        for (int i = 0; i < workload->size; i++) text = grow_text(text, &length, &capacity, ")");
+        text = grow_text(text, &length, &capacity, "))");
+    } else {
+        // Every definition is a distinct closed shape, so each one has to be found in the index
+        for (int i = 0; i < workload->size; i++) {
+            snprintf(part, sizeof(part), "(\\x.(\\y.((x y)c%d)))", i);
+            char* input = part;
+            BaseToken* value;
+            parse_str(&input, &value);
+            snprintf(part, sizeof(part), "d%d", i);
+            insert_variable(table, intern_symbol(part, strlen(part)), value);
+            end_command();
+        }
+        for (int i = 1; i < workload->size; i++) text = grow_text(text, &length, &capacity, "(");
+        text = grow_text(text, &length, &capacity, "d0");
+        for (int i = 1; i < workload->size; i++) {
+            snprintf(part, sizeof(part), i == 1 ? " d%d)" : "d%d)", i);
+            text = grow_text(text, &length, &capacity, part);
+        }
+    }
+    return text;
+}
+
+static BaseToken* parse_text(const char* text) {
+    char* input = (char*)text;
+    BaseToken* token;
+    parse_str(&input, &token);
+    return token;
+}
+
+static void expand_all(BaseToken** token, HashTable* table, unsigned long long* passes) {
+    while (expand_varriable(token, table)) (*passes)++;
+}
+
+/*Hash of the names and values of a table in definition order, equal tables get the same hash however they were filled*/
+static unsigned int table_hash(HashTable* table) {
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < table->count; i++) {
+        for (const char* name = symbol_name(table->entries[i]->symbol); *name; name++) hash = (hash ^ (unsigned char)*name) * 16777619u;
+        hash = (hash ^ table->entries[i]->value->hash) * 16777619u;
+    }
+    return hash;
+}
+
+/*Fills a new table from the prelude or its snapshot once per pass*/
+static void run_startup(const Workload* workload, const char* prelude, BenchResult* result) {
+    char snapshot[] = "/tmp/lambda_bench_XXXXXX";
+    if (workload->kind == BENCH_RESTORE) {
+        HashTable* table = calloc(1, sizeof(HashTable));
+        int fd = mkstemp(snapshot);
+        if (!table || fd < 0 || execute_file(prelude, table) < 0 || save_snapshot(table, snapshot) < 0) {
+            result->failed = 1;
+            return;
+        }
+        close(fd);
+        free_table(table);
+    }
+
+    for (int i = 0; i < workload->repeat; i++) {
+        HashTable* table = calloc(1, sizeof(HashTable));
+        if (!table) {
+            result->failed = 1;
+            break;
+        }
+        size_t tokens_before = tokens_allocated();
+        double start = now();
+        int count = workload->kind == BENCH_LOAD ? execute_file(prelude, table) : restore_snapshot(table, snapshot);
+        result->seconds += now() - start;
+        result->tokens += tokens_allocated() - tokens_before;
+        result->operations++;
+        result->result_hash = table_hash(table);
+        if (count < 0) result->failed = 1;
+        free_table(table);
+        end_command();
+    }
+
+    if (workload->kind == BENCH_RESTORE) unlink(snapshot);
+    free_arenas();
+}
+
+static void run_workload(const Workload* workload, const char* prelude, BenchResult* result) {
+    if (workload->kind == BENCH_LOAD || workload->kind == BENCH_RESTORE) {
+        run_startup(workload, prelude, result);
+        return;
+    }
+
+    HashTable* table = calloc(1, sizeof(HashTable));
+    if (!table || execute_file(prelude, table) < 0) {
+        result->failed = 1;
+        return;
+    }
+    if (workload->kind == BENCH_DELTA) {
+        // Every operation is bound to the prelude definition of the same name
+        for (int op = 1; op < PRIM_COUNT; op++) {
+            HashVarriable* entry = get_variable_entry(table, intern_symbol(prim_name(op), strlen(prim_name(op))));
+            if (entry && check_primitive(entry->value, op, table)) entry->prim = op;
+        }
+        end_command();
+    }
+    char* generated = workload->input == INPUT_NONE ? NULL : generate_input(workload, table);
+    const char* text = generated ? generated : workload->term;
+    FILE* sink = NULL;
+    if (workload->kind == BENCH_PRINT && !(sink = fopen("/dev/null", "w"))) {
+        result->failed = 1;
+        free(generated);
+        free_table(table);
+        return;
+    }
+
+    for (int i = 0; i < workload->repeat; i++) {
+        double start;
+        size_t tokens_before;
+        BaseToken* token;
+
+        if (workload->kind == BENCH_PARSE) {
+            tokens_before = tokens_allocated();
+            start = now();
+            token = parse_text(text);
+            result->operations++;
+        } else if (workload->kind == BENCH_EXPAND) {
+            token = parse_text(text);
+            tokens_before = tokens_allocated();
+            start = now();
+            expand_all(&token, table, &result->operations);
+        } else if (workload->kind == BENCH_LAZY) {
+            token = parse_text(text);
+            tokens_before = tokens_allocated();
+            start = now();
+            Reducer reducer;
+            reducer_start(&reducer, token, table);
+            while (reducer_step(&reducer)) result->reductions++;
+            token = reducer_finish(&reducer);
+        } else {
+            // Reductions and contractions start from the fully expanded term
+            token = parse_text(text);
+            unsigned long long passes = 0;
+            expand_all(&token, table, &passes);
+            tokens_before = tokens_allocated();
+            start = now();
+            if (workload->kind == BENCH_REDUCE) {
+                Reducer reducer;
+                reducer_start(&reducer, token, NULL);
+                while (reducer_step(&reducer)) result->reductions++;
+                token = reducer_finish(&reducer);
+            } else if (workload->kind == BENCH_DELTA) {
+                u_int64_t steps = command_stats.beta_steps + command_stats.delta_steps;
+                u_int64_t taken;
+                BaseToken* reduced = delta_reduce(token, UINT64_MAX, table, &taken);
+                free_token(token);
+                token = reduced;
+                result->reductions += command_stats.beta_steps + command_stats.delta_steps - steps;
+            } else if (workload->kind == BENCH_PRINT) {
+                fprint_parse(sink, token);
+                result->operations++;
+            } else if (workload->kind == BENCH_COMPACT) {
+                Budget budget = {0};
+                budget.steps = UINT64_MAX;
+                BaseToken* reduced = compact_reduce(token, &budget);
+                free_token(token);
+                token = reduced;
+                result->reductions += budget.taken;
+            } else {
+                while (contract_varriable(&token, table)) result->operations++;
+            }
+        }
+
+        result->seconds += now() - start;
+        result->tokens += tokens_allocated() - tokens_before;
+        result->result_hash = token->hash;
+        free_token(token);
+        end_command();
+    }
+
+    if (sink) fclose(sink);
+    free(generated);
+    free_table(table);
+    free_arenas();
+}
+
+static const char* kind_names[] = {"parse", "reduce", "expand", "contract", "load", "restore", "delta", "compact", "lazy", "print"};
+
+/*Runs the workload in a child so its peak memory is its own*/
+static int bench_workload(const Workload* workload, const char* prelude) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("Failed to open pipe");
+        exit(EXIT_FAILURE);
+    }
+    fflush(stdout);
+    pid_t child = fork();
+    if (child < 0) {
+        perror("Failed to fork");
+        exit(EXIT_FAILURE);
+    }
+    if (child == 0) {
+        close(fds[0]);
+        BenchResult result = {0};
+        run_workload(workload, prelude, &result);
+        ssize_t written = write(fds[1], &result, sizeof(result));
+        _exit(written == sizeof(result) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    close(fds[1]);
+    BenchResult result = {0};
+    ssize_t got = read(fds[0], &result, sizeof(result));
+    close(fds[0]);
+    int status;
+    struct rusage usage;
+    wait4(child, &status, 0, &usage);
+    if (got != sizeof(result) || !WIFEXITED(status) || WEXITSTATUS(status) != 0 || result.failed) {
+        printf("{\"workload\":\"%s\",\"kind\":\"%s\",\"failed\":true}\n", workload->name, kind_names[workload->kind]);
+        return 0;
+    }
+
+    double seconds = result.seconds > 0 ? result.seconds : 1e-9;
+    printf("{\"workload\":\"%s\",\"kind\":\"%s\",\"repeat\":%d,\"wall_s\":%.6f,\"reductions\":%llu,"
+        "\"reductions_per_s\":%.0f,\"operations\":%llu,\"operations_per_s\":%.0f,\"tokens_allocated\":%llu,"
+        "\"peak_rss_kb\":%ld,\"result_hash\":%u}\n",
+        workload->name, kind_names[workload->kind], workload->repeat, result.seconds, result.reductions,
+        result.reductions / seconds, result.operations, result.operations / seconds, result.tokens,
+        usage.ru_maxrss, result.result_hash);
+    return 1;
+}
+
+int main(int argc, char* argv[]) {
+    const char* prelude = "bench/prelude.lc";
+    int first = 1;
+    if (argc > 2 && strcmp(argv[1], "-p") == 0) {
+        prelude = argv[2];
+        first = 3;
+    }
+    if (argc > first && strcmp(argv[first], "--help") == 0) {
+        printf("Usage: %s [-p PRELUDE] [WORKLOAD...]\nWorkloads:", argv[0]);
+        for (size_t i = 0; i < sizeof(workloads) / sizeof(Workload); i++) printf(" %s", workloads[i].name);
+        printf("\n");
+        return EXIT_SUCCESS;
+    }
+
+    // Without names every workload runs, otherwise only the named ones
+    int status = EXIT_SUCCESS;
+    for (size_t i = 0; i < sizeof(workloads) / sizeof(Workload); i++) {
+        int selected = argc == first;
+        for (int j = first; j < argc; j++) selected |= strcmp(argv[j], workloads[i].name) == 0;
+        if (selected && !bench_workload(&workloads[i], prelude)) status = EXIT_FAILURE;
+    }
+    return status;
+}
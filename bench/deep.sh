@@ -0,0 +1,44 @@
+#!/bin/bash
+# Regression benchmark for deep terms, every command has to finish without overflowing the native stack
+# Usage: bench/deep.sh [depth] [binary]
+DEPTH=${1:-1000000}
+BIN=${2:-build/lambda_calc}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+# A Church numeral, the same numeral with other names, functions nested DEPTH deep
+# and an application spine with its only redex at the bottom
+awk -v n="$DEPTH" 'BEGIN {
+    printf "def numeral (\\f.(\\x."; for (i = 0; i < n; i++) printf "(f"; printf " x"; for (i = 0; i < n; i++) printf ")"; printf "))\n";
+    printf "def renamed (\\g.(\\y."; for (i = 0; i < n; i++) printf "(g"; printf " y"; for (i = 0; i < n; i++) printf ")"; printf "))\n";
+    printf "def nested "; for (i = 0; i < n; i++) printf "(\\v%d.", i; printf "v0"; for (i = 0; i < n; i++) printf ")"; printf "\n";
+    printf "def spine "; for (i = 0; i < n; i++) printf "("; printf "(\\z.z)a"; for (i = 1; i < n; i++) printf ")a"; printf ")\n";
+}' > "$DIR/deep.lc"
+
+fail=0
+TIMEFORMAT="%3R s"
+run() {
+    printf '%-34s' "$1"
+    { time printf '%s\nexit\n' "$1" | "$BIN" -f "$DIR/deep.lc" > "$DIR/out" 2>&1; } 2>&1 | tr -d '\n'
+    if ! grep -q "Exiting program" "$DIR/out"; then
+        printf '  FAILED'
+        fail=1
+    fi
+    printf '\n'
+}
+
+echo "depth $DEPTH"
+run "ex numeral"
+run "mem numeral"
+run "con ex numeral"
+run "br 1 ex spine"
+run "br 1 ex ((\\w.w)nested)"
+run "eval ex ((numeral g)z)"
+run "eval numeral"
+run "eval --need numeral"
+run "br --need 10 ex spine"
+run "br --net 10 ex numeral"
+run "br --compact 1 ex spine"
+run "run 2 spine"
+run "def numeral x"
+exit $fail
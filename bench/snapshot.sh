@@ -0,0 +1,37 @@
+#!/bin/bash
+# Restores corrupted snapshots, every one has to be refused and no command after it may crash
+# Usage: bench/snapshot.sh [binary]
+BIN=${1:-build/lambda_calc}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+# The image of id holds the varriable x as node 0 and the function as node 1
+# The header takes 24 bytes and every node 20: type, index, name and two children
+printf 'def id (\\x.x)\nsave %s\n' "$DIR/good.img" | "$BIN" -b > /dev/null 2>&1
+if [ ! -s "$DIR/good.img" ]; then
+    echo "could not save $DIR/good.img"
+    exit 1
+fi
+
+fail=0
+corrupt() {
+    local name=$1 offset=$2 bytes=$3
+    cp "$DIR/good.img" "$DIR/$name.img"
+    printf "$bytes" | dd of="$DIR/$name.img" bs=1 seek="$offset" conv=notrunc status=none
+    printf '%-24s' "$name"
+    printf 'restore %s\nshow\nbr ex (id a)\nrun 10 (id a)\neval ex (id a)\n' "$DIR/$name.img" |
+        "$BIN" -b > "$DIR/out" 2>&1
+    status=$?
+    if [ $status -ne 0 ] || ! grep -q "Failed Restoring Snapshot" "$DIR/out"; then
+        printf '  FAILED'
+        fail=1
+    fi
+    printf '\n'
+}
+
+corrupt "varriable without name" 32 '\xff\xff\xff\xff'
+corrupt "function without name" 52 '\xff\xff\xff\xff'
+corrupt "index past its binders" 28 '\x05\x00\x00\x00'
+corrupt "child after its parent" 56 '\x01\x00\x00\x00'
+corrupt "unknown type" 24 '\x03\x00\x00\x00'
+exit $fail
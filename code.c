@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "code.h"
+
+static Instr* emit(Code* code, u_int32_t op, u_int32_t arg, Symbol name) {
+    // Every offset has to fit the argument of an instruction
+    if (code->count == UINT32_MAX) {
+        fprintf(stderr, "Term too large to compile\n");
+        exit(EXIT_FAILURE);
+    }
+    if (code->count == code->capacity) {
+        code->capacity = code->capacity ? code->capacity * 2 : 64;
+        code->instrs = realloc(code->instrs, code->capacity * sizeof(Instr));
+        if (!code->instrs) {
+            perror("Failed to allocate memory for code");
+            exit(EXIT_FAILURE);
+        }
+    }
+    Instr* instr = &code->instrs[code->count++];
+    instr->op = op;
+    instr->arg = arg;
+    instr->name = name;
+    return instr;
+}
+
+/*Token still to compile, and the application whose argument offset is set before it*/
+typedef struct CompileFrame {
+    BaseToken* token;
+    size_t app; // Index of the application instruction, SIZE_MAX when there is none
+} CompileFrame;
+
+/*Stack of tokens still to compile*/
+typedef struct CompileStack {
+    CompileFrame* frames;
+    size_t depth;
+    size_t capacity;
+} CompileStack;
+
+static void push_compile(CompileStack* stack, BaseToken* token, size_t app) {
+    if (stack->depth == stack->capacity) {
+        stack->capacity = stack->capacity ? stack->capacity * 2 : 256;
+        stack->frames = realloc(stack->frames, stack->capacity * sizeof(CompileFrame));
+        if (!stack->frames) {
+            perror("Failed to allocate memory for code");
+            exit(EXIT_FAILURE);
+        }
+    }
+    stack->frames[stack->depth].token = token;
+    stack->frames[stack->depth++].app = app;
+}
+
+static void compile_token(Code* code, BaseToken* token, HashTable* table) {
+    CompileStack stack = {NULL, 0, 0};
+    PointerMap compiled = {0}; // Start plus one of the code of every function and application
+    push_compile(&stack, token, SIZE_MAX);
+
+    while (stack.depth > 0) {
+        CompileFrame frame = stack.frames[--stack.depth];
+        token = frame.token;
+
+        // The offset of the argument is only known once the function is compiled
+        if (frame.app != SIZE_MAX) code->instrs[frame.app].arg = code->count - frame.app;
+
+        // The whole code of a token is written before anything outside of it, so a shared token can point back to it
+        if (token->type != 0) {
+            size_t start = (uintptr_t)pointer_map_get(&compiled, token);
+            if (start) {
+                emit(code, OP_SHARED, code->count - (start - 1), 0);
+                continue;
+            }
+            pointer_map_put(&compiled, token, (void*)(uintptr_t)(code->count + 1));
+        }
+
+        if (token->type == 0) {
+            if (token->index > 0) {
+                emit(code, OP_VAR, token->index, token->symbol);
+                continue;
+            }
+            HashVarriable* entry = table ? get_variable_entry(table, token->symbol) : NULL;
+            if (entry) emit(code, OP_GLOBAL, 0, 0)->entry = entry;
+            else emit(code, OP_NAME, 0, token->symbol);
+        } else if (token->type == 1) {
+            emit(code, OP_LAM, 0, token->symbol);
+            push_compile(&stack, token->in_values[0], SIZE_MAX);
+        } else {
+            // The argument is compiled after the function so it goes below it on the stack
+            push_compile(&stack, token->in_values[1], code->count);
+            emit(code, OP_APP, 0, 0);
+            push_compile(&stack, token->in_values[0], SIZE_MAX);
+        }
+    }
+    free(stack.frames);
+    pointer_map_free(&compiled);
+}
+
+Code* compile_code(BaseToken* token, HashTable* table) {
+    Code* code = malloc(sizeof(Code));
+    if (!code) {
+        perror("Failed to allocate memory for code");
+        exit(EXIT_FAILURE);
+    }
+    code->instrs = NULL;
+    code->count = 0;
+    code->capacity = 0;
+    compile_token(code, token, table);
+    return code;
+}
+
+/*Batch workers can reach the same definition at once, only one of them compiles it*/
+static pthread_mutex_t compile_lock = PTHREAD_MUTEX_INITIALIZER;
+
+Code* definition_code(HashVarriable* entry, HashTable* table) {
+    Code* code = __atomic_load_n(&entry->code, __ATOMIC_ACQUIRE);
+    if (code) return code;
+
+    pthread_mutex_lock(&compile_lock);
+    code = entry->code;
+    if (!code) {
+        code = compile_code(entry->value, table);
+        __atomic_store_n(&entry->code, code, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&compile_lock);
+    return code;
+}
+
+Symbol instr_name(const Instr* instr) {
+    if (instr->op == OP_GLOBAL) return instr->entry->symbol;
+    return instr->name;
+}
+
+void free_code(Code* code) {
+    if (!code) return;
+    free(code->instrs);
+    free(code);
+}
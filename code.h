@@ -0,0 +1,45 @@
+#ifndef CODE
+#define CODE
+
+#include "lambda_calc.h"
+
+/*Instructions of compiled terms, a term is laid out in prefix order and every shared token is compiled once*/
+#define OP_VAR 0 // Varriable with De Bruijn index arg
+#define OP_NAME 1 // Free name that wasn't defined when the code was compiled
+#define OP_GLOBAL 2 // Defined name, runs the code of the definition
+#define OP_LAM 3 // Function, the body follows
+#define OP_APP 4 // Application, the function follows and the argument starts arg instructions further
+#define OP_SHARED 5 // Token compiled before, its code starts arg instructions back
+
+/*Instruction the term at instr starts with, only children can be OP_SHARED and they never point to another one*/
+#define SHARED_TARGET(instr) ((instr)->op == OP_SHARED ? (instr) - (instr)->arg : (instr))
+
+typedef struct Instr {
+    u_int32_t op;
+    u_int32_t arg;
+    union {
+        Symbol name; // Name of varriables, functions and free names
+        HashVarriable* entry; // Definition of OP_GLOBAL
+    };
+} Instr;
+
+/*Compiled term*/
+typedef struct Code {
+    Instr* instrs;
+    size_t count;
+    size_t capacity;
+} Code;
+
+/*Compiles the token, free names defined in the table become references to the definition
+Offsets are 32 bit, a term that would need more instructions stops the program*/
+Code* compile_code(BaseToken* token, HashTable* table);
+
+/*Code of a definition, compiled the first time it is needed*/
+Code* definition_code(HashVarriable* entry, HashTable* table);
+
+/*Name of the varriable, function or free name of an instruction*/
+Symbol instr_name(const Instr* instr);
+
+void free_code(Code* code);
+
+#endif
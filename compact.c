@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "compact.h"
+#include "stats.h"
+
+/*What a rewrite of the store does to the varriables it reaches*/
+#define COMPACT_SHIFT 0 // Adds the offset to every index above the cutoff
+#define COMPACT_SUBSTITUTE 1 // Replaces the index of the removed function by the value
+
+static void* grow_compact(void* array, size_t size, size_t capacity) {
+    array = realloc(array, capacity * size);
+    if (!array) {
+        perror("Failed to allocate memory for compact store");
+        exit(EXIT_FAILURE);
+    }
+    return array;
+}
+
+static void grow_nodes(CompactStore* store) {
+    if (store->capacity == UINT32_MAX) {
+        fprintf(stderr, "Compact store is out of node indices\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t capacity = store->capacity ? (size_t)store->capacity * 2 : COMPACT_START;
+    if (capacity > UINT32_MAX) capacity = UINT32_MAX;
+    store->types = grow_compact(store->types, sizeof(u_int8_t), capacity);
+    store->in0 = grow_compact(store->in0, sizeof(u_int32_t), capacity);
+    store->in1 = grow_compact(store->in1, sizeof(u_int32_t), capacity);
+    store->symbols = grow_compact(store->symbols, sizeof(Symbol), capacity);
+    store->loose = grow_compact(store->loose, sizeof(u_int32_t), capacity);
+    store->capacity = capacity;
+}
+
+static u_int32_t add_node(CompactStore* store, u_int8_t type, Symbol symbol, u_int32_t in0, u_int32_t in1) {
+    if (store->count == store->capacity) grow_nodes(store);
+    u_int32_t node = store->count++;
+    store->types[node] = type;
+    store->symbols[node] = symbol;
+    store->in0[node] = in0;
+    store->in1[node] = in1;
+    if (type == 0) store->loose[node] = in0;
+    else if (type == 1) store->loose[node] = store->loose[in0] > 0 ? store->loose[in0] - 1 : 0;
+    else store->loose[node] = store->loose[in0] > store->loose[in1] ? store->loose[in0] : store->loose[in1];
+    return node;
+}
+
+static void push_frame(CompactStore* store, u_int32_t node, u_int32_t depth) {
+    if (store->frame_count == store->frame_capacity) {
+        store->frame_capacity = store->frame_capacity ? store->frame_capacity * 2 : 256;
+        store->frames = grow_compact(store->frames, sizeof(CompactFrame), store->frame_capacity);
+    }
+    store->frames[store->frame_count++] = (CompactFrame){node, depth, 0};
+}
+
+static void push_result(CompactStore* store, u_int32_t node) {
+    if (store->result_count == store->result_capacity) {
+        store->result_capacity = store->result_capacity ? store->result_capacity * 2 : 256;
+        store->results = grow_compact(store->results, sizeof(u_int32_t), store->result_capacity);
+    }
+    store->results[store->result_count++] = node;
+}
+
+void compact_from_token(CompactStore* store, BaseToken* token) {
+    // Position plus one of every copied token, a token is copied once its children are
+    PointerMap ids = {0};
+    size_t capacity = 256;
+    BaseToken** stack = grow_compact(NULL, sizeof(BaseToken*), capacity);
+    size_t count = 0;
+    stack[count++] = token;
+    while (count > 0) {
+        BaseToken* current = stack[count - 1];
+        if (pointer_map_get(&ids, current)) {
+            count--;
+            continue;
+        }
+        int missing = 0;
+        for (int i = current->type - 1; i >= 0; i--) {
+            if (pointer_map_get(&ids, current->in_values[i])) continue;
+            if (count == capacity) {
+                capacity *= 2;
+                stack = grow_compact(stack, sizeof(BaseToken*), capacity);
+            }
+            stack[count++] = current->in_values[i];
+            missing = 1;
+        }
+        if (missing) continue;
+
+        u_int32_t node;
+        if (current->type == 0) node = add_node(store, 0, current->symbol, current->index, 0);
+        else if (current->type == 1) node = add_node(store, 1, current->symbol, (size_t)pointer_map_get(&ids, current->in_values[0]) - 1, 0);
+        else node = add_node(store, 2, 0, (size_t)pointer_map_get(&ids, current->in_values[0]) - 1, (size_t)pointer_map_get(&ids, current->in_values[1]) - 1);
+        pointer_map_put(&ids, current, (void*)((size_t)node + 1));
+        count--;
+    }
+    store->root = (size_t)pointer_map_get(&ids, token) - 1;
+    store->collected = store->count;
+    free(stack);
+    pointer_map_free(&ids);
+}
+
+/*Marks the nodes reachable from the node, children come first so one sweep down from it finds them all*/
+static u_int8_t* mark_nodes(CompactStore* store, u_int32_t node) {
+    u_int8_t* marks = calloc((size_t)node + 1, sizeof(u_int8_t));
+    if (!marks) {
+        perror("Failed to allocate memory for compact store");
+        exit(EXIT_FAILURE);
+    }
+    marks[node] = 1;
+    for (size_t i = (size_t)node + 1; i-- > 0;) {
+        if (!marks[i] || store->types[i] == 0) continue;
+        marks[store->in0[i]] = 1;
+        if (store->types[i] == 2) marks[store->in1[i]] = 1;
+    }
+    return marks;
+}
+
+BaseToken* compact_to_token(CompactStore* store, u_int32_t node) {
+    u_int8_t* marks = mark_nodes(store, node);
+    BaseToken** tokens = malloc(((size_t)node + 1) * sizeof(BaseToken*));
+    if (!tokens) {
+        perror("Failed to allocate memory for compact store");
+        exit(EXIT_FAILURE);
+    }
+    for (u_int32_t i = 0; i <= node; i++) {
+        if (!marks[i]) continue;
+        if (store->types[i] == 0) tokens[i] = make_var(store->symbols[i], store->in0[i]);
+        else if (store->types[i] == 1) tokens[i] = make_function(store->symbols[i], retain_token(tokens[store->in0[i]]));
+        else tokens[i] = make_application(retain_token(tokens[store->in0[i]]), retain_token(tokens[store->in1[i]]));
+    }
+
+    BaseToken* result = retain_token(tokens[node]);
+    for (u_int32_t i = 0; i <= node; i++) if (marks[i]) free_token(tokens[i]);
+    free(tokens);
+    free(marks);
+    return result;
+}
+
+static u_int32_t rewrite_node(CompactStore* store, u_int32_t node, u_int32_t depth, int kind, u_int32_t value, int offset);
+
+/*Result for a node without visiting its children, UINT32_MAX to rebuild it from its rewritten children*/
+static u_int32_t rewrite_visit(CompactStore* store, u_int32_t node, u_int32_t depth, int kind, u_int32_t value, int offset) {
+    u_int32_t index = store->in0[node];
+    if (kind == COMPACT_SHIFT) {
+        // Nothing inside points above the cutoff so the node can be shared as is
+        if (store->loose[node] <= depth) return node;
+        if (store->types[node] != 0) return UINT32_MAX;
+        STAT_ADD(shifted, 1);
+        return add_node(store, 0, store->symbols[node], index + offset, 0);
+    }
+
+    // Neither the replaced varriable nor any outer one is used inside
+    if (store->loose[node] < depth) return node;
+    if (store->types[node] != 0) return UINT32_MAX;
+    if (index == depth) {
+        // The value moves under the functions in between so its outer indices are shifted past them
+        STAT_ADD(substitutions, 1);
+        return depth > 1 ? rewrite_node(store, value, 0, COMPACT_SHIFT, 0, depth - 1) : value;
+    }
+    // Varriables bound outside of the removed function lose one level
+    return add_node(store, 0, store->symbols[node], index - 1, 0);
+}
+
+/*Rebuilds the node bottom up like rewrite_token, nodes whose children didn't change are kept*/
+static u_int32_t rewrite_node(CompactStore* store, u_int32_t node, u_int32_t depth, int kind, u_int32_t value, int offset) {
+    size_t base = store->frame_count;
+    push_frame(store, node, depth);
+
+    while (store->frame_count > base) {
+        CompactFrame* frame = &store->frames[store->frame_count - 1];
+        u_int32_t current = frame->node;
+        u_int8_t type = store->types[current];
+
+        if (frame->state == 0) {
+            u_int32_t result = rewrite_visit(store, current, frame->depth, kind, value, offset);
+            if (result != UINT32_MAX) {
+                store->frame_count--;
+                push_result(store, result);
+                continue;
+            }
+            // The visit can start a walk of its own and move the stack
+            frame = &store->frames[store->frame_count - 1];
+        }
+
+        if (frame->state < type) {
+            u_int32_t child = frame->state++ == 0 ? store->in0[current] : store->in1[current];
+            push_frame(store, child, frame->depth + (type == 1));
+            continue;
+        }
+
+        store->frame_count--;
+        u_int32_t in1 = type == 2 ? store->results[--store->result_count] : 0;
+        u_int32_t in0 = store->results[--store->result_count];
+        u_int32_t result = current;
+        if (in0 != store->in0[current] || (type == 2 && in1 != store->in1[current]))
+            result = add_node(store, type, store->symbols[current], in0, in1);
+        push_result(store, result);
+    }
+    return store->results[--store->result_count];
+}
+
+int compact_step(CompactStore* store) {
+    // Depth first search for the leftmost outermost redex, the frames are the path down to it
+    u_int64_t start = stats_timing ? stats_clock() : 0;
+    u_int64_t visits = 1;
+    size_t base = store->frame_count;
+    push_frame(store, store->root, 0);
+    while (store->frame_count > base) {
+        CompactFrame* frame = &store->frames[store->frame_count - 1];
+        u_int32_t current = frame->node;
+        u_int8_t type = store->types[current];
+        if (frame->state == 0 && type == 2 && store->types[store->in0[current]] == 1) break;
+        if (frame->state < type) {
+            push_frame(store, frame->state++ == 0 ? store->in0[current] : store->in1[current], 0);
+            visits++;
+            continue;
+        }
+        store->frame_count--;
+    }
+    STAT_ADD(search_visits, visits);
+    if (stats_timing) start = stats_phase(PHASE_SEARCH, start);
+    if (store->frame_count == base) return 0;
+
+    u_int32_t redex = store->frames[--store->frame_count].node;
+    u_int32_t result = rewrite_node(store, store->in0[store->in0[redex]], 1, COMPACT_SUBSTITUTE, store->in1[redex], 0);
+    STAT_ADD(beta_steps, 1);
+
+    // Rebuild the path around the reduced child, everything else is shared
+    while (store->frame_count > base) {
+        CompactFrame* frame = &store->frames[--store->frame_count];
+        u_int32_t current = frame->node;
+        if (store->types[current] == 1) result = add_node(store, 1, store->symbols[current], result, 0);
+        else if (frame->state == 1) result = add_node(store, 2, 0, result, store->in1[current]);
+        else result = add_node(store, 2, 0, store->in0[current], result);
+    }
+    store->root = result;
+    if (stats_timing) stats_phase(PHASE_SUBSTITUTE, start);
+    return 1;
+}
+
+void compact_collect(CompactStore* store) {
+    u_int8_t* marks = mark_nodes(store, store->root);
+
+    // New positions never pass old ones so the nodes move down in place, children before their parents
+    u_int32_t* moved = malloc(((size_t)store->root + 1) * sizeof(u_int32_t));
+    if (!moved) {
+        perror("Failed to allocate memory for compact store");
+        exit(EXIT_FAILURE);
+    }
+    u_int32_t count = 0;
+    for (u_int32_t i = 0; i <= store->root; i++) {
+        if (!marks[i]) continue;
+        moved[i] = count;
+        store->types[count] = store->types[i];
+        store->symbols[count] = store->symbols[i];
+        store->loose[count] = store->loose[i];
+        store->in0[count] = store->types[i] == 0 ? store->in0[i] : moved[store->in0[i]];
+        store->in1[count] = store->types[i] == 2 ? moved[store->in1[i]] : 0;
+        count++;
+    }
+    store->root = moved[store->root];
+    store->count = count;
+    store->collected = count;
+    free(moved);
+    free(marks);
+}
+
+void compact_run(CompactStore* store, Budget* budget) {
+    while (!budget_spent(budget)) {
+        // The token arenas hardly grow here so the memory budget is held against the store
+        if (budget->memory && budget->taken % BUDGET_CHECK_STEPS == 0 &&
+            (size_t)store->count * COMPACT_NODE_BYTES >= budget->memory) {
+            budget->stop = STOP_MEMORY;
+            break;
+        }
+        if (!compact_step(store)) {
+            budget->stop = STOP_NORMAL;
+            break;
+        }
+        budget->taken++;
+        // Every step leaves its old path behind, the live nodes are moved down once the store doubled
+        if (store->count >= COMPACT_MIN_COLLECT && store->count / 2 >= store->collected) compact_collect(store);
+    }
+}
+
+BaseToken* compact_reduce(BaseToken* token, Budget* budget) {
+    CompactStore store = {0};
+    compact_from_token(&store, token);
+    compact_run(&store, budget);
+    compact_collect(&store);
+    BaseToken* result = compact_to_token(&store, store.root);
+    compact_free(&store);
+    return result;
+}
+
+void compact_free(CompactStore* store) {
+    free(store->types);
+    free(store->in0);
+    free(store->in1);
+    free(store->symbols);
+    free(store->loose);
+    free(store->frames);
+    free(store->results);
+    memset(store, 0, sizeof(CompactStore));
+}
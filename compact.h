@@ -0,0 +1,62 @@
+#ifndef COMPACT
+#define COMPACT
+
+#include "lambda_calc.h"
+
+/*Nodes a store starts with, it doubles whenever it is full*/
+#define COMPACT_START 4096
+/*Stores smaller than this are never collected, a collection is only worth it once the garbage is large*/
+#define COMPACT_MIN_COLLECT (1 << 16)
+
+/*Node on the explicit stack of a walk over a store*/
+typedef struct CompactFrame {
+    u_int32_t node;
+    u_int32_t depth; // Functions between the start of the walk and the node
+    u_int8_t state; // Children visited so far
+} CompactFrame;
+
+/*Term kept as parallel arrays, a node is its position and its children always come before it
+Nodes are never changed after they are made, a reduction step appends the rebuilt path and shares the rest*/
+typedef struct CompactStore {
+    u_int8_t* types; // Type of the node like the type of a BaseToken
+    u_int32_t* in0; // Body of a function, function of an application, De Bruijn index of a varriable
+    u_int32_t* in1; // Value of an application
+    Symbol* symbols; // Name of a varriable or function
+    u_int32_t* loose; // Highest index pointing outside of the node, like BaseToken
+    u_int32_t count;
+    u_int32_t capacity;
+    u_int32_t root;
+    u_int32_t collected; // Nodes left by the last collection, the next one waits until the store doubles
+    CompactFrame* frames; // Walks of the search and the substitution, each keeps the part above its base
+    size_t frame_count;
+    size_t frame_capacity;
+    u_int32_t* results; // Nodes rebuilt by the walks
+    size_t result_count;
+    size_t result_capacity;
+} CompactStore;
+
+/*Bytes each node takes in a store*/
+#define COMPACT_NODE_BYTES (sizeof(u_int8_t) + 3 * sizeof(u_int32_t) + sizeof(Symbol))
+
+/*Copies the token into an empty store, shared tokens become one node, the root is set to it*/
+void compact_from_token(CompactStore* store, BaseToken* token);
+
+/*Token of the node, made in the active arena*/
+BaseToken* compact_to_token(CompactStore* store, u_int32_t node);
+
+/*Reduces the leftmost outermost redex of the root, 0 when there is none*/
+int compact_step(CompactStore* store);
+
+/*Moves the nodes reachable from the root to the front of the store and drops the rest*/
+void compact_collect(CompactStore* store);
+
+/*Reduces the root in normal order until it is in normal form or the budget is spent, the memory budget counts the store*/
+void compact_run(CompactStore* store, Budget* budget);
+
+/*Reduces the token on a store and returns the result as a token*/
+BaseToken* compact_reduce(BaseToken* token, Budget* budget);
+
+/*Frees the arrays of the store*/
+void compact_free(CompactStore* store);
+
+#endif
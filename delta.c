@@ -0,0 +1,463 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "delta.h"
+#include "stats.h"
+
+static const char* prim_names[PRIM_COUNT] = {NULL, "succ", "pred", "iszero", "add", "sub", "mul", "pow"};
+static const int prim_arities[PRIM_COUNT] = {0, 1, 1, 1, 2, 2, 2, 2};
+
+/*Token of the path down to the next step*/
+typedef struct DeltaFrame {
+    BaseToken* token;
+    u_int8_t state; // Children pushed so far
+    u_int8_t stuck; // A primitive whose arguments aren't all literals, unfolded when they have no step left
+} DeltaFrame;
+
+/*State of one br --delta*/
+typedef struct DeltaRun {
+    BaseToken* definitions[PRIM_COUNT]; // Expanded value bound to every operation, NULL when none is
+    PointerMap done; // Results of shared tokens of a conversion
+    DeltaFrame* frames;
+    size_t count;
+    size_t capacity;
+    BaseToken** args; // Arguments of the spine being looked at
+    size_t arg_count;
+    size_t arg_capacity;
+} DeltaRun;
+
+static void* grow_delta(void* array, size_t* capacity, size_t size) {
+    *capacity = *capacity ? *capacity * 2 : 256;
+    array = realloc(array, *capacity * size);
+    if (!array) {
+        perror("Failed to allocate memory for delta reduction");
+        exit(EXIT_FAILURE);
+    }
+    return array;
+}
+
+int prim_op(const char* name) {
+    for (int op = 1; op < PRIM_COUNT; op++) {
+        if (strcmp(name, prim_names[op]) == 0) return op;
+    }
+    return 0;
+}
+
+const char* prim_name(int op) {
+    return prim_names[op];
+}
+
+int prim_arity(int op) {
+    return prim_arities[op];
+}
+
+int delta_kind(BaseToken* token, u_int64_t* value) {
+    if (token->type != 0 || token->index != 0 || !token->symbol) return DELTA_NONE;
+    const char* name = symbol_name(token->symbol);
+    if (name[0] != '#') return DELTA_NONE;
+    name++;
+
+    if (*name >= '0' && *name <= '9') {
+        u_int64_t number = 0;
+        for (; *name; name++) {
+            if (*name < '0' || *name > '9' || number > (UINT64_MAX - (*name - '0')) / 10) return DELTA_NONE;
+            number = number * 10 + (*name - '0');
+        }
+        *value = number;
+        return DELTA_NUMBER;
+    }
+    if (strcmp(name, "true") == 0) return DELTA_TRUE;
+    if (strcmp(name, "false") == 0) return DELTA_FALSE;
+    int op = prim_op(name);
+    if (!op) return DELTA_NONE;
+    *value = op;
+    return DELTA_PRIM;
+}
+
+static Symbol delta_symbol(const char* name) {
+    return intern_symbol(name, strlen(name));
+}
+
+/*Free name standing for the literal or primitive*/
+static BaseToken* make_literal(int kind, u_int64_t value) {
+    char name[32];
+    if (kind == DELTA_NUMBER) snprintf(name, sizeof(name), "#%llu", (unsigned long long)value);
+    else if (kind == DELTA_TRUE) strcpy(name, "#true");
+    else if (kind == DELTA_FALSE) strcpy(name, "#false");
+    else snprintf(name, sizeof(name), "#%s", prim_names[value]);
+    return make_var(delta_symbol(name), 0);
+}
+
+/*Church form of a number or boolean, a number takes as many tokens as it counts*/
+static BaseToken* church_literal(int kind, u_int64_t value) {
+    if (kind == DELTA_NUMBER) {
+        Symbol f = delta_symbol("f");
+        Symbol x = delta_symbol("x");
+        BaseToken* body = make_var(x, 1);
+        for (u_int64_t i = 0; i < value; i++) body = make_application(make_var(f, 2), body);
+        return make_function(f, make_function(x, body));
+    }
+    Symbol x = delta_symbol("x");
+    Symbol y = delta_symbol("y");
+    BaseToken* body = kind == DELTA_TRUE ? make_var(x, 2) : make_var(y, 1);
+    return make_function(x, make_function(y, body));
+}
+
+/*Number or boolean of a closed Church form, \f.\x.f(f x) or \x.\y.x, false is the same function as 0*/
+static int church_kind(BaseToken* token, u_int64_t* value) {
+    if (token->type != 1 || token->loose != 0 || token->in_values[0]->type != 1) return DELTA_NONE;
+    BaseToken* body = token->in_values[0]->in_values[0];
+    if (body->type == 0 && body->index == 2) return DELTA_TRUE;
+
+    u_int64_t count = 0;
+    while (body->type == 2 && body->in_values[0]->type == 0 && body->in_values[0]->index == 2) {
+        count++;
+        body = body->in_values[1];
+    }
+    if (body->type != 0 || body->index != 1) return DELTA_NONE;
+    *value = count;
+    return DELTA_NUMBER;
+}
+
+/*Number of an argument given as a literal or still in Church form*/
+static int number_argument(BaseToken* token, u_int64_t* value) {
+    int kind = delta_kind(token, value);
+    if (kind == DELTA_NONE) kind = church_kind(token, value);
+    if (kind == DELTA_FALSE) {
+        *value = 0;
+        return 1;
+    }
+    return kind == DELTA_NUMBER;
+}
+
+/*Computes the operation on the arguments, 0 when one isn't a number or the result doesn't fit*/
+static int apply_prim(int op, BaseToken** args, BaseToken** result) {
+    u_int64_t a = 0;
+    u_int64_t b = 0;
+    u_int64_t n;
+    if (!number_argument(args[0], &a)) return 0;
+    if (prim_arities[op] > 1 && !number_argument(args[1], &b)) return 0;
+
+    switch (op) {
+    case PRIM_SUCC:
+        if (a == UINT64_MAX) return 0;
+        n = a + 1;
+        break;
+    case PRIM_PRED:
+        n = a ? a - 1 : 0;
+        break;
+    case PRIM_ISZERO:
+        *result = make_literal(a == 0 ? DELTA_TRUE : DELTA_FALSE, 0);
+        return 1;
+    case PRIM_ADD:
+        if (a > UINT64_MAX - b) return 0;
+        n = a + b;
+        break;
+    case PRIM_SUB:
+        n = a > b ? a - b : 0;
+        break;
+    case PRIM_MUL:
+        if (b && a > UINT64_MAX / b) return 0;
+        n = a * b;
+        break;
+    default:
+        // Powers of 0 and 1 stop changing, every other base overflows within 64 rounds
+        n = 1;
+        for (u_int64_t i = 0; i < b; i++) {
+            if (a && n > UINT64_MAX / a) return 0;
+            n *= a;
+            if (n <= 1) break;
+        }
+        break;
+    }
+    *result = make_literal(DELTA_NUMBER, n);
+    return 1;
+}
+
+/*Applies the token to the arguments from the given one on, takes over the reference to the token*/
+static BaseToken* apply_rest(BaseToken* token, BaseToken** args, size_t from, size_t count) {
+    for (size_t i = from; i < count; i++) token = make_application(token, retain_token(args[i]));
+    return token;
+}
+
+/*Head below the applications of the token, its arguments are stored in order*/
+static BaseToken* spine(DeltaRun* run, BaseToken* token) {
+    run->arg_count = 0;
+    while (token->type == 2) {
+        if (run->arg_count == run->arg_capacity) run->args = grow_delta(run->args, &run->arg_capacity, sizeof(BaseToken*));
+        run->args[run->arg_count++] = token->in_values[1];
+        token = token->in_values[0];
+    }
+    for (size_t i = 0; i < run->arg_count / 2; i++) {
+        BaseToken* swap = run->args[i];
+        run->args[i] = run->args[run->arg_count - 1 - i];
+        run->args[run->arg_count - 1 - i] = swap;
+    }
+    return token;
+}
+
+/*Literal applied to one argument that nothing else is applied to, it becomes the function the Church form would reduce to*/
+static BaseToken* expand_literal(int kind, u_int64_t value, BaseToken* arg) {
+    Symbol x = delta_symbol("x");
+    if (kind == DELTA_FALSE || (kind == DELTA_NUMBER && value == 0)) return make_function(x, make_var(x, 1));
+
+    // The argument moves under the new function
+    BaseToken* shifted = shift_indices(arg, 1, 0);
+    if (kind == DELTA_TRUE) return make_function(x, shifted);
+    BaseToken* body = make_var(x, 1);
+    for (u_int64_t i = 0; i < value; i++) body = make_application(retain_token(shifted), body);
+    free_token(shifted);
+    return make_function(x, body);
+}
+
+/*Literal in function position choosing between or repeating its two arguments*/
+static BaseToken* select_literal(int kind, u_int64_t value, BaseToken* first, BaseToken* second) {
+    if (kind == DELTA_TRUE) return retain_token(first);
+    BaseToken* result = retain_token(second);
+    if (kind == DELTA_NUMBER) {
+        for (u_int64_t i = 0; i < value; i++) result = make_application(retain_token(first), result);
+    }
+    return result;
+}
+
+/*Bound definition applied to the arguments of the spine, NULL when the operation has none*/
+static BaseToken* unfold_primitive(DeltaRun* run, BaseToken* token) {
+    u_int64_t op = 0;
+    BaseToken* head = spine(run, token);
+    delta_kind(head, &op);
+    BaseToken* definition = run->definitions[op];
+    if (!definition) return NULL;
+    return apply_rest(retain_token(definition), run->args, 0, run->arg_count);
+}
+
+/*Step for the outermost application of a spine headed by a literal or primitive, NULL when there is none yet*/
+static BaseToken* delta_rule(DeltaRun* run, DeltaFrame* frame) {
+    u_int64_t value = 0;
+    BaseToken* head = spine(run, frame->token);
+    int kind = delta_kind(head, &value);
+    if (kind == DELTA_NONE) return NULL;
+
+    if (kind != DELTA_PRIM) {
+        if (run->arg_count == 0) return NULL;
+        if (run->arg_count == 1) return expand_literal(kind, value, run->args[0]);
+        return apply_rest(select_literal(kind, value, run->args[0], run->args[1]), run->args, 2, run->arg_count);
+    }
+
+    // Missing arguments can't be computed, the definition takes over like in ordinary reduction
+    int arity = prim_arities[value];
+    if ((int)run->arg_count < arity) return unfold_primitive(run, frame->token);
+    BaseToken* result;
+    if (apply_prim(value, run->args, &result)) return apply_rest(result, run->args, arity, run->arg_count);
+
+    // Primitives are strict, the arguments are reduced first and the definition is only used if they stay other terms
+    frame->stuck = run->definitions[value] != NULL;
+    return NULL;
+}
+
+/*The token is the function of the application above it*/
+static int function_position(DeltaRun* run) {
+    if (run->count < 2) return 0;
+    DeltaFrame* parent = &run->frames[run->count - 2];
+    return parent->token->type == 2 && parent->state == 1;
+}
+
+static void push_frame(DeltaRun* run, BaseToken* token) {
+    if (run->count == run->capacity) run->frames = grow_delta(run->frames, &run->capacity, sizeof(DeltaFrame));
+    run->frames[run->count++] = (DeltaFrame){token, 0, 0};
+}
+
+/*Takes the leftmost outermost beta or delta step, 0 when there is none*/
+static int delta_step(BaseToken** token, DeltaRun* run) {
+    u_int64_t visits = 1;
+    BaseToken* result = NULL;
+    run->count = 0;
+    push_frame(run, *token);
+    while (run->count > 0) {
+        DeltaFrame* frame = &run->frames[run->count - 1];
+        BaseToken* current = frame->token;
+        if (frame->state == 0) {
+            if (current->type == 2 && current->in_values[0]->type == 1) {
+                result = retain_token(current);
+                beta_reduction(&result);
+                break;
+            }
+            // Only the whole spine is looked at, its inner applications are the functions of outer ones
+            if (current->type != 1 && !function_position(run)) {
+                result = delta_rule(run, frame);
+                if (result) {
+                    STAT_ADD(delta_steps, 1);
+                    break;
+                }
+            }
+        }
+        if (frame->state < current->type) {
+            push_frame(run, current->in_values[frame->state++]);
+            visits++;
+            continue;
+        }
+        if (frame->stuck) {
+            result = unfold_primitive(run, current);
+            STAT_ADD(delta_steps, 1);
+            break;
+        }
+        run->count--;
+    }
+    STAT_ADD(search_visits, visits);
+    if (!result) return 0;
+
+    // Rebuild the path around the replaced token, everything else is shared
+    run->count--;
+    while (run->count > 0) {
+        DeltaFrame* frame = &run->frames[--run->count];
+        BaseToken* current = frame->token;
+        if (current->type == 1) result = make_function(current->symbol, result);
+        else if (frame->state == 1) result = make_application(result, retain_token(current->in_values[1]));
+        else result = make_application(retain_token(current->in_values[0]), result);
+    }
+    free_token(*token);
+    *token = result;
+    stats_max_size(result->size);
+    return 1;
+}
+
+static void remember_delta(BaseToken* token, BaseToken* result, void* data) {
+    pointer_map_put(&((DeltaRun*)data)->done, token, result);
+}
+
+/*Closed numerals, booleans and bound definitions become literals*/
+static BaseToken* native_visit(BaseToken* token, u_int32_t depth, void* data) {
+    (void)depth;
+    DeltaRun* run = data;
+    BaseToken* known = pointer_map_get(&run->done, token);
+    if (known) return retain_token(known);
+    if (token->type == 0 || token->loose != 0) return NULL;
+
+    BaseToken* result = NULL;
+    u_int64_t value;
+    int kind = church_kind(token, &value);
+    if (kind != DELTA_NONE) result = make_literal(kind, value);
+
+    // Only a handful of definitions can be bound, most tokens differ from all of them by hash
+    for (int op = 1; op < PRIM_COUNT && !result; op++) {
+        BaseToken* definition = run->definitions[op];
+        if (definition && definition->hash == token->hash && token_equal(token, definition)) result = make_literal(DELTA_PRIM, op);
+    }
+    if (result) pointer_map_put(&run->done, token, result);
+    return result;
+}
+
+/*Literals become Church forms and primitives their definitions again*/
+static BaseToken* church_visit(BaseToken* token, u_int32_t depth, void* data) {
+    (void)depth;
+    DeltaRun* run = data;
+    BaseToken* known = pointer_map_get(&run->done, token);
+    if (known) return retain_token(known);
+
+    u_int64_t value = 0;
+    int kind = delta_kind(token, &value);
+    if (kind == DELTA_NONE) return NULL;
+    if (kind == DELTA_PRIM) return run->definitions[value] ? retain_token(run->definitions[value]) : NULL;
+    BaseToken* result = church_literal(kind, value);
+    pointer_map_put(&run->done, token, result);
+    return result;
+}
+
+BaseToken* expand_definition(BaseToken* value, HashTable* table) {
+    BaseToken* token = retain_token(value);
+    for (int i = 0; i < 1000 && expand_varriable(&token, table); i++);
+    return token;
+}
+
+int check_primitive(BaseToken* value, int op, HashTable* table) {
+    value = expand_definition(value, table);
+    // Powers to 0 reduce to \x.x, the eta reduced form of 1, so it matches 1 as well
+    BaseToken* identity = make_function(delta_symbol("x"), make_var(delta_symbol("x"), 1));
+    int binary = prim_arities[op] == 2;
+    for (u_int64_t a = 0; a <= PRIM_CHECK_MAX; a++) {
+        for (u_int64_t b = 0; b <= (binary ? PRIM_CHECK_MAX : 0); b++) {
+            BaseToken* args[2] = {church_literal(DELTA_NUMBER, a), church_literal(DELTA_NUMBER, b)};
+            BaseToken* literal;
+            apply_prim(op, args, &literal);
+            u_int64_t number = 0;
+            int kind = delta_kind(literal, &number);
+            BaseToken* expected = church_literal(kind, number);
+            free_token(literal);
+
+            BaseToken* term = make_application(retain_token(value), args[0]);
+            if (binary) term = make_application(term, args[1]);
+            else free_token(args[1]);
+            for (int i = 0; i < PRIM_CHECK_STEPS && beta_reduction_search(&term); i++);
+
+            int same = token_equal(term, expected) || (kind == DELTA_NUMBER && number == 1 && token_equal(term, identity));
+            free_token(term);
+            free_token(expected);
+            if (!same) {
+                free_token(identity);
+                free_token(value);
+                return 0;
+            }
+        }
+    }
+    free_token(identity);
+    free_token(value);
+    return 1;
+}
+
+/*Expands the definitions bound to every operation*/
+static void open_delta(DeltaRun* run, HashTable* table) {
+    memset(run, 0, sizeof(DeltaRun));
+    for (size_t i = 0; i < table->count; i++) {
+        HashVarriable* entry = table->entries[i];
+        if (!entry->prim) continue;
+        free_token(run->definitions[entry->prim]);
+        run->definitions[entry->prim] = expand_definition(entry->value, table);
+    }
+}
+
+static void close_delta(DeltaRun* run) {
+    for (int op = 1; op < PRIM_COUNT; op++) free_token(run->definitions[op]);
+    pointer_map_free(&run->done);
+    free(run->frames);
+    free(run->args);
+}
+
+BaseToken* delta_native(BaseToken* token, HashTable* table) {
+    DeltaRun run;
+    open_delta(&run, table);
+    BaseToken* term = rewrite_token(token, 0, native_visit, remember_delta, &run);
+    close_delta(&run);
+    return term;
+}
+
+void delta_run(BaseToken** term, Budget* budget, HashTable* table) {
+    DeltaRun run;
+    open_delta(&run, table);
+    while (!budget_spent(budget)) {
+        if (!delta_step(term, &run)) {
+            budget->stop = STOP_NORMAL;
+            break;
+        }
+        budget->taken++;
+    }
+    close_delta(&run);
+}
+
+BaseToken* delta_church(BaseToken* term, HashTable* table) {
+    DeltaRun run;
+    open_delta(&run, table);
+    BaseToken* result = rewrite_token(term, 0, church_visit, remember_delta, &run);
+    close_delta(&run);
+    return result;
+}
+
+BaseToken* delta_reduce(BaseToken* token, u_int64_t limit, HashTable* table, u_int64_t* steps) {
+    Budget budget = {0};
+    budget.steps = limit;
+    BaseToken* term = delta_native(token, table);
+    delta_run(&term, &budget, table);
+    *steps = budget.taken;
+    BaseToken* result = delta_church(term, table);
+    free_token(term);
+    return result;
+}
@@ -0,0 +1,60 @@
+#ifndef DELTA
+#define DELTA
+
+#include "lambda_calc.h"
+
+/*What a free name of br --delta stands for, literals and primitives are names starting with #*/
+#define DELTA_NONE 0
+#define DELTA_NUMBER 1 // #42, a Church numeral
+#define DELTA_TRUE 2 // #true
+#define DELTA_FALSE 3 // #false, the same function as #0
+#define DELTA_PRIM 4 // #add, a definition bound to a builtin operation
+
+/*Builtin operations a definition can be bound to with prim, 0 is none*/
+#define PRIM_SUCC 1
+#define PRIM_PRED 2
+#define PRIM_ISZERO 3
+#define PRIM_ADD 4
+#define PRIM_SUB 5 // Stops at 0 like the Church version
+#define PRIM_MUL 6
+#define PRIM_POW 7 // pow b e is b to the power of e
+#define PRIM_COUNT 8
+
+/*Small numerals a definition is reduced on before it is bound, every result has to match the builtin*/
+#define PRIM_CHECK_MAX 3
+/*Reductions each of those checks may take*/
+#define PRIM_CHECK_STEPS 100000
+
+/*Operation of the name, 0 when it isn't one*/
+int prim_op(const char* name);
+
+/*Name of the operation*/
+const char* prim_name(int op);
+
+/*Number of arguments the operation takes*/
+int prim_arity(int op);
+
+/*Kind of literal or primitive the token names, its number or operation goes to value*/
+int delta_kind(BaseToken* token, u_int64_t* value);
+
+/*Value of the definition with every name it uses expanded*/
+BaseToken* expand_definition(BaseToken* value, HashTable* table);
+
+/*Checks the definition against the builtin on small numerals with ordinary reduction, 1 when every result matches*/
+int check_primitive(BaseToken* value, int op, HashTable* table);
+
+/*Token with closed numerals, booleans and bound definitions replaced by literals*/
+BaseToken* delta_native(BaseToken* token, HashTable* table);
+
+/*Takes beta and delta steps on a term made by delta_native until it is in normal form or the budget is spent*/
+void delta_run(BaseToken** term, Budget* budget, HashTable* table);
+
+/*Token with the literals turned back into Church forms and the primitives into their definitions*/
+BaseToken* delta_church(BaseToken* term, HashTable* table);
+
+/*Reduces the token in normal order with at most limit steps, numerals and booleans are machine integers
+and applications of bound definitions to them are computed by the builtins, the result is in Church form again
+The steps taken go to steps, fewer than limit when the result is a normal form*/
+BaseToken* delta_reduce(BaseToken* token, u_int64_t limit, HashTable* table, u_int64_t* steps);
+
+#endif
@@ -1,23 +1,29 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
 #include <readline/readline.h>
 #include <readline/history.h>
-#include <time.h>
 #include "lambda_calc.h"
-
-
-static error_t parse_opt(int key, char *arg, struct argp_state *state) {
-    struct arguments *arguments = state->input;
-
-    switch (key) {
-        case 'v': arguments->verbose = 1; break;
-        case 'f': arguments->load_file = arg; break;
-        case ARGP_KEY_END: break;
-        default: return ARGP_ERR_UNKNOWN;
-    }
-    return 0;
-}
+#include "arena.h"
+#include "machine.h"
+#include "net.h"
+#include "code.h"
+#include "pool.h"
+#include "parallel.h"
+#include "compact.h"
+#include "stats.h"
+#include "snapshot.h"
+#include "delta.h"
+#include "memo.h"
+#include "session.h"
 
 char* add_prefix(const char* prefix, const char* str) {
     size_t prefix_len = strlen(prefix);
@@ -36,62 +42,564 @@ char* add_prefix(const char* prefix, const char* str) {
     return result;
 }
 
-char* generate_random_string(char spacer,size_t length) {
-    if (length == 0) return NULL; // Safety check
+static NameTable names;
+static StringArena name_strings;
+/*Batch workers intern names while they parse, lookups share the lock and new names take it alone*/
+static pthread_rwlock_t names_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/*Token arenas, indexed by the arena field of the tokens
+Every thread has its own command arena, only the main thread makes table tokens so the others never touch theirs*/
+static __thread NodeArena token_arenas[2] = {
+    [COMMAND_ARENA] = {.block_size = sizeof(BaseToken), .slab_blocks = 4096},
+    [TABLE_ARENA] = {.block_size = sizeof(BaseToken), .slab_blocks = 1024},
+};
+/*Hash consing tables of the arenas*/
+static __thread UniqueTable unique_tables[2];
+/*Arena new tokens are made in, references to tokens of other arenas are borrowed*/
+static __thread u_int8_t active_arena = COMMAND_ARENA;
+/*Arena of the commands of this thread, reduction workers use their own so the others only borrow their tokens*/
+static __thread u_int8_t command_arena = COMMAND_ARENA;
+
+/*Every arena but the table one is the command arena of the thread that made its tokens*/
+#define ARENA_SLOT(arena) ((arena) == TABLE_ARENA ? TABLE_ARENA : COMMAND_ARENA)
+
+static unsigned int hash_name(const char* str, size_t len) {
+    unsigned int hash = 5381;
+    for (size_t i = 0; i < len; i++)
+        hash = ((hash << 5) + hash) + str[i];  // DJB2 hash algorithm
+    return hash;
+}
+
+/*Chunks of symbol names, chunk n holds the names of symbols n * SYMBOL_CHUNK_SIZE + 1 and up*/
+static const char** symbol_chunks[SYMBOL_CHUNKS];
+
+const char* symbol_name(Symbol symbol) {
+    Symbol slot = symbol - 1;
+    return symbol_chunks[slot / SYMBOL_CHUNK_SIZE][slot % SYMBOL_CHUNK_SIZE];
+}
 
-    char* random_string = malloc(length + 2); // Allocate memory (+1 for null terminator)
-    if (!random_string) {
-        perror("Memory allocation failed");
+static void grow_names(void) {
+    size_t capacity = names.capacity ? names.capacity * 2 : 256;
+    Symbol* slots = calloc(capacity, sizeof(Symbol));
+    if (!slots) {
+        perror("Failed to allocate memory for name table");
         exit(EXIT_FAILURE);
     }
 
-    size_t charset_size = sizeof(CHARSET) - 1;
-    random_string[0] = spacer;
-    for (size_t i = 1; i < length + 1; i++) {
-        random_string[i] = CHARSET[rand() % charset_size]; // Pick a random character
+    // Rehash the old names into the new slots
+    for (size_t i = 0; i < names.capacity; i++) {
+        if (!names.slots[i]) continue;
+        const char* name = symbol_name(names.slots[i]);
+        size_t index = hash_name(name, strlen(name)) & (capacity - 1);
+        while (slots[index]) index = (index + 1) & (capacity - 1);
+        slots[index] = names.slots[i];
     }
+    free(names.slots);
+    names.slots = slots;
+    names.capacity = capacity;
+}
 
-    random_string[length + 1] = '\0'; // Null terminate the string
-    return random_string;
+/*Returns the slot of the name or the empty slot it would go in*/
+static size_t find_name(const char* str, size_t len) {
+    size_t index = hash_name(str, len) & (names.capacity - 1);
+    while (names.slots[index]) {
+        const char* name = symbol_name(names.slots[index]);
+        if (strncmp(name, str, len) == 0 && name[len] == '\0')
+            return index;
+        index = (index + 1) & (names.capacity - 1);
+    }
+    return index;
 }
 
-void free_token(BaseToken* token){
-    if (!token) return;
+/*Gives the copied name the next symbol, called with the write lock held*/
+static Symbol add_symbol(const char* str, size_t len) {
+    Symbol slot = names.count;
+    if (slot / SYMBOL_CHUNK_SIZE >= SYMBOL_CHUNKS) {
+        fprintf(stderr, "Too many names\n");
+        exit(EXIT_FAILURE);
+    }
+    const char*** chunk = &symbol_chunks[slot / SYMBOL_CHUNK_SIZE];
+    if (!*chunk) {
+        *chunk = malloc(SYMBOL_CHUNK_SIZE * sizeof(const char*));
+        if (!*chunk) {
+            perror("Failed to allocate memory for name table");
+            exit(EXIT_FAILURE);
+        }
+    }
+    (*chunk)[slot % SYMBOL_CHUNK_SIZE] = string_arena_copy(&name_strings, str, len);
+    return ++names.count;
+}
+
+Symbol intern_symbol(const char* str, size_t len) {
+    // Almost every name is already known, those are found without blocking other readers
+    pthread_rwlock_rdlock(&names_lock);
+    Symbol known = names.capacity ? names.slots[find_name(str, len)] : 0;
+    pthread_rwlock_unlock(&names_lock);
+    if (known) return known;
+
+    pthread_rwlock_wrlock(&names_lock);
+    if (names.count * 2 >= names.capacity) grow_names();
+    size_t index = find_name(str, len);
+    if (!names.slots[index]) names.slots[index] = add_symbol(str, len);
+    Symbol symbol = names.slots[index];
+    pthread_rwlock_unlock(&names_lock);
+    return symbol;
+}
 
-    if(token->type == 0 || token->type == 1){
-        free(token->var_name);
+void free_names(void) {
+    free(names.slots);
+    for (size_t i = 0; i < SYMBOL_CHUNKS && symbol_chunks[i]; i++) {
+        free(symbol_chunks[i]);
+        symbol_chunks[i] = NULL;
     }
-    
-    // Only loop through existing children
+    memset(&names, 0, sizeof(NameTable));
+    string_arena_free(&name_strings);
+}
+
+static BaseToken* new_token(u_int8_t arena){
+    BaseToken* token = arena_alloc(&token_arenas[ARENA_SLOT(arena)]);
+    memset(token, 0, sizeof(BaseToken));
+    token->arena = arena;
+    token->refs = 1;
+    STAT_ADD(tokens_made, 1);
+    return token;
+}
+
+static void clear_unique_table(UniqueTable* unique){
+    // A table that grew for one big command doesn't stay big for the next ones
+    if (unique->capacity > UNIQUE_TABLE_SIZE) {
+        free(unique->buckets);
+        unique->buckets = NULL;
+        unique->capacity = 0;
+    } else if (unique->buckets) {
+        memset(unique->buckets, 0, unique->capacity * sizeof(BaseToken*));
+    }
+    unique->count = 0;
+}
+
+void end_command(void){
+    arena_reset(&token_arenas[COMMAND_ARENA]);
+    clear_unique_table(&unique_tables[COMMAND_ARENA]);
+}
+
+size_t tokens_allocated(void){
+    return token_arenas[COMMAND_ARENA].allocated + token_arenas[TABLE_ARENA].allocated;
+}
+
+size_t tokens_live(void){
+    return token_arenas[COMMAND_ARENA].live + token_arenas[TABLE_ARENA].live;
+}
+
+int budget_spent(Budget* budget){
+    if (budget->taken >= budget->steps){
+        budget->stop = STOP_STEPS;
+        return 1;
+    }
+    // A clock read costs about as much as a small step so the other limits are only looked at now and then
+    if (budget->taken % BUDGET_CHECK_STEPS != 0) return 0;
+    if (budget->deadline && stats_clock() >= budget->deadline){
+        budget->stop = STOP_TIME;
+        return 1;
+    }
+    if (budget->memory && tokens_live() * sizeof(BaseToken) >= budget->memory){
+        budget->stop = STOP_MEMORY;
+        return 1;
+    }
+    return 0;
+}
+
+void use_worker_arena(u_int8_t arena){
+    command_arena = arena;
+    active_arena = arena;
+}
+
+u_int8_t set_active_arena(u_int8_t arena){
+    u_int8_t previous = active_arena;
+    active_arena = arena;
+    return previous;
+}
+
+static void free_walk(void);
+
+void free_thread_arenas(void){
     for (int i = 0; i < 2; i++){
-        if (token->in_values[i]) {
-            free_token(token->in_values[i]);
-            token->in_values[i] = NULL;
+        arena_free(&token_arenas[i]);
+        clear_unique_table(&unique_tables[i]);
+        free(unique_tables[i].buckets);
+        unique_tables[i].buckets = NULL;
+        unique_tables[i].capacity = 0;
+    }
+    free_walk();
+    memo_free_thread();
+}
+
+void free_arenas(void){
+    free_thread_arenas();
+    free_names();
+}
+
+static u_int32_t mix_hash(u_int32_t hash, u_int32_t value){
+    hash ^= value + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    return hash;
+}
+
+static int same_token(BaseToken* token, u_int8_t type, Symbol symbol, u_int32_t index, BaseToken* in0, BaseToken* in1){
+    return token->type == type && token->symbol == symbol && token->index == index &&
+        token->in_values[0] == in0 && token->in_values[1] == in1;
+}
+
+static void set_metadata(BaseToken* token){
+    BaseToken* in0 = token->in_values[0];
+    BaseToken* in1 = token->in_values[1];
+    if (token->type == 0){
+        token->loose = token->index;
+        token->names = token->index == 0 ? NAME_BIT(token->symbol) : 0;
+        token->size = 1;
+    } else if (token->type == 1){
+        token->loose = in0->loose > 0 ? in0->loose - 1 : 0;
+        token->names = in0->names;
+        token->size = in0->size + 1;
+    } else {
+        token->loose = in0->loose > in1->loose ? in0->loose : in1->loose;
+        token->names = in0->names | in1->names;
+        // Size counts the token as a tree so it saturates instead of overflowing on big shared terms
+        token->size = in0->size + in1->size + 1;
+        if (token->size <= in0->size || token->size <= in1->size) token->size = UINT64_MAX;
+    }
+}
+
+static void grow_unique_table(UniqueTable* unique){
+    size_t capacity = unique->capacity ? unique->capacity * 2 : UNIQUE_TABLE_SIZE;
+    BaseToken** buckets = calloc(capacity, sizeof(BaseToken*));
+    if (!buckets) {
+        perror("Failed to allocate memory for unique table");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < unique->capacity; i++){
+        BaseToken* token = unique->buckets[i];
+        while (token){
+            BaseToken* next = token->next_shared;
+            size_t index = token->hash & (capacity - 1);
+            token->next_shared = buckets[index];
+            buckets[index] = token;
+            token = next;
         }
     }
-    free(token);
-    token = NULL;
+    free(unique->buckets);
+    unique->buckets = buckets;
+    unique->capacity = capacity;
 }
 
-unsigned int hash(const char* str) {
-    unsigned int hash = 5381;
-    while (*str)
-        hash = ((hash << 5) + hash) + *str++;  // DJB2 hash algorithm
-    return hash % TABLE_SIZE;
+/*Returns the existing token with the same contents or a new one, the children references are taken over*/
+static BaseToken* share_token(u_int8_t type, Symbol symbol, u_int32_t index, BaseToken* in0, BaseToken* in1, u_int32_t hash){
+    UniqueTable* unique = &unique_tables[ARENA_SLOT(active_arena)];
+    if (unique->count >= unique->capacity) grow_unique_table(unique);
+
+    size_t bucket = hash & (unique->capacity - 1);
+    u_int64_t probes = 0;
+    for (BaseToken* token = unique->buckets[bucket]; token; token = token->next_shared){
+        probes++;
+        if (token->hash == hash && same_token(token, type, symbol, index, in0, in1)){
+            // The existing token already holds its own references to the children
+            free_token(in0);
+            free_token(in1);
+            STAT_ADD(unique_probes, probes);
+            STAT_ADD(shared, 1);
+            return retain_token(token);
+        }
+    }
+    STAT_ADD(unique_probes, probes);
+
+    BaseToken* token = new_token(active_arena);
+    token->type = type;
+    token->symbol = symbol;
+    token->index = index;
+    token->in_values[0] = in0;
+    token->in_values[1] = in1;
+    token->hash = hash;
+    set_metadata(token);
+    token->next_shared = unique->buckets[bucket];
+    unique->buckets[bucket] = token;
+    unique->count++;
+    return token;
 }
 
-HashVarriable** get_all_variable_entries(HashTable* ht, int* count) {
-    *count = 0;  // Initialize count
+BaseToken* make_var(Symbol symbol, u_int32_t index){
+    // Bound varriables hash by index only so the hash doesn't depend on the chosen names
+    u_int32_t hash = mix_hash(mix_hash(1, index), index == 0 ? symbol : 0);
+    return share_token(0, symbol, index, NULL, NULL, hash);
+}
+
+BaseToken* make_function(Symbol symbol, BaseToken* body){
+    return share_token(1, symbol, 0, body, NULL, mix_hash(2, body->hash));
+}
+
+BaseToken* make_application(BaseToken* func, BaseToken* value){
+    return share_token(2, 0, 0, func, value, mix_hash(mix_hash(3, func->hash), value->hash));
+}
+
+BaseToken* retain_token(BaseToken* token){
+    // Tokens of another arena are only borrowed, their owner keeps them alive
+    if (token && token->arena == active_arena) token->refs++;
+    return token;
+}
 
-    // Count the number of stored variables
-    for (int i = 0; i < TABLE_SIZE; i++) {
-        HashVarriable* entry = ht->table[i];
-        while (entry) {
-            (*count)++;
-            entry = entry->next;
+void free_token(BaseToken* token){
+    // Applications waiting for their second child to be released, linked through next_shared once out of the unique table
+    BaseToken* parents = NULL;
+
+    while (1){
+        if (token && token->arena == active_arena && --token->refs == 0){
+            // Unlink the token from the unique table before the memory is reused
+            UniqueTable* unique = &unique_tables[ARENA_SLOT(token->arena)];
+            BaseToken** link = &unique->buckets[token->hash & (unique->capacity - 1)];
+            while (*link != token) link = &(*link)->next_shared;
+            *link = token->next_shared;
+            unique->count--;
+
+            if (token->in_values[1]){
+                token->next_shared = parents;
+                parents = token;
+                token = token->in_values[0];
+                continue;
+            }
+            BaseToken* child = token->in_values[0];
+            arena_release(&token_arenas[ARENA_SLOT(token->arena)], token);
+            STAT_ADD(tokens_freed, 1);
+            token = child;
+            continue;
         }
+        if (!parents) break;
+
+        BaseToken* parent = parents;
+        parents = parent->next_shared;
+        token = parent->in_values[1];
+        arena_release(&token_arenas[ARENA_SLOT(parent->arena)], parent);
+        STAT_ADD(tokens_freed, 1);
     }
+}
+
+/*Token on the explicit stack of a walk, the stack is shared by nested walks that each keep the part above their base*/
+typedef struct WalkFrame{
+    BaseToken* token;
+    BaseToken* other; // Token compared against in token_equal
+    u_int32_t depth; // Functions entered since the walk started, or index being looked for
+    u_int8_t state; // Children already pushed
+} WalkFrame;
+
+typedef struct WalkStack{
+    WalkFrame* frames;
+    size_t count;
+    size_t capacity;
+    BaseToken** results; // Finished tokens of rewrite_token
+    size_t result_count;
+    size_t result_capacity;
+} WalkStack;
+
+static __thread WalkStack walk;
+
+static void free_walk(void){
+    free(walk.frames);
+    free(walk.results);
+    memset(&walk, 0, sizeof(WalkStack));
+}
+
+static void* grow_stack(void* array, size_t* capacity, size_t size){
+    *capacity = *capacity ? *capacity * 2 : 256;
+    array = realloc(array, *capacity * size);
+    if (!array) {
+        perror("Failed to allocate memory for stack");
+        exit(EXIT_FAILURE);
+    }
+    return array;
+}
+
+static void push_walk(BaseToken* token, BaseToken* other, u_int32_t depth){
+    if (walk.count == walk.capacity) walk.frames = grow_stack(walk.frames, &walk.capacity, sizeof(WalkFrame));
+    WalkFrame* frame = &walk.frames[walk.count++];
+    frame->token = token;
+    frame->other = other;
+    frame->depth = depth;
+    frame->state = 0;
+}
+
+static void push_result(BaseToken* token){
+    if (walk.result_count == walk.result_capacity)
+        walk.results = grow_stack(walk.results, &walk.result_capacity, sizeof(BaseToken*));
+    walk.results[walk.result_count++] = token;
+}
+
+BaseToken* rewrite_token(BaseToken* token, u_int32_t depth, RewriteVisit visit, RewriteBuilt built, void* data){
+    size_t base = walk.count;
+    push_walk(token, NULL, depth);
+
+    while (walk.count > base){
+        WalkFrame* frame = &walk.frames[walk.count - 1];
+        BaseToken* current = frame->token;
+
+        if (frame->state == 0){
+            BaseToken* result = visit(current, frame->depth, data);
+            if (!result && current->type == 0) result = retain_token(current);
+            if (result){
+                walk.count--;
+                push_result(result);
+                continue;
+            }
+            // The visit can start a walk of its own and move the stack
+            frame = &walk.frames[walk.count - 1];
+        }
+
+        if (frame->state < current->type){
+            u_int32_t childDepth = frame->depth + (current->type == 1);
+            push_walk(current->in_values[frame->state++], NULL, childDepth);
+            continue;
+        }
 
+        walk.count--;
+        BaseToken* in0;
+        BaseToken* in1 = NULL;
+        if (current->type == 2) in1 = walk.results[--walk.result_count];
+        in0 = walk.results[--walk.result_count];
+
+        // A token of another arena is only kept when its children are from the same arena, copies have to be rebuilt
+        BaseToken* result;
+        if (in0 == current->in_values[0] && in1 == current->in_values[1] && (current->arena == active_arena || current->arena == in0->arena)){
+            free_token(in0);
+            free_token(in1);
+            result = retain_token(current);
+        } else if (current->type == 1){
+            result = make_function(current->symbol, in0);
+        } else {
+            result = make_application(in0, in1);
+        }
+        if (built) built(current, result, data);
+        push_result(result);
+    }
+    return walk.results[--walk.result_count];
+}
+
+/*Home slot of a key, mixed so neighbouring arena addresses spread out*/
+static size_t pointer_map_slot(PointerMap* map, void* key){
+    return (size_t)(((uintptr_t)key * 0x9E3779B97F4A7C15ull) >> 32) & (map->capacity - 1);
+}
+
+void* pointer_map_get(PointerMap* map, void* key){
+    if (map->count == 0) return NULL;
+    size_t index = pointer_map_slot(map, key);
+    while (map->keys[index]){
+        if (map->keys[index] == key) return map->values[index];
+        index = (index + 1) & (map->capacity - 1);
+    }
+    return NULL;
+}
+
+void pointer_map_put(PointerMap* map, void* key, void* value){
+    if ((map->count + 1) * 2 > map->capacity){
+        PointerMap grown = {0};
+        grown.capacity = map->capacity ? map->capacity * 2 : 64;
+        grown.keys = calloc(grown.capacity, sizeof(void*));
+        grown.values = calloc(grown.capacity, sizeof(void*));
+        if (!grown.keys || !grown.values) {
+            perror("Failed to allocate memory for pointer map");
+            exit(EXIT_FAILURE);
+        }
+        for (size_t i = 0; i < map->capacity; i++){
+            if (map->keys[i]) pointer_map_put(&grown, map->keys[i], map->values[i]);
+        }
+        free(map->keys);
+        free(map->values);
+        *map = grown;
+    }
+
+    size_t index = pointer_map_slot(map, key);
+    while (map->keys[index] && map->keys[index] != key) index = (index + 1) & (map->capacity - 1);
+    if (!map->keys[index]) map->count++;
+    map->keys[index] = key;
+    map->values[index] = value;
+}
+
+void pointer_map_free(PointerMap* map){
+    free(map->keys);
+    free(map->values);
+    memset(map, 0, sizeof(PointerMap));
+}
+
+static BaseToken* copy_visit(BaseToken* token, u_int32_t depth, void* copies){
+    (void)depth;
+    if (token->arena == active_arena) return retain_token(token);
+
+    // Shared tokens are copied once
+    BaseToken* copy = pointer_map_get(copies, token);
+    if (copy) return retain_token(copy);
+
+    if (token->type == 0) {
+        STAT_ADD(cloned, 1);
+        return make_var(token->symbol, token->index);
+    }
+    return NULL;
+}
+
+static void remember_rewrite(BaseToken* token, BaseToken* result, void* map){
+    pointer_map_put(map, token, result);
+}
+
+BaseToken* clone_into(BaseToken* token, u_int8_t arena) {
+    if (!token) return NULL;  // Handle NULL input
+
+    u_int8_t previous = active_arena;
+    active_arena = arena;
+    PointerMap copies = {0};
+    BaseToken* copy = rewrite_token(token, 0, copy_visit, remember_rewrite, &copies);
+    STAT_ADD(cloned, copies.count);
+    pointer_map_free(&copies);
+    active_arena = previous;
+    return copy;
+}
+
+BaseToken* clone_base_token(BaseToken* token) {
+    // Tokens are never changed in place so a clone is another reference to the same token
+    return retain_token(token);
+}
+
+/*Home slot of a symbol in the definition index*/
+static size_t symbol_slot(HashTable* ht, Symbol symbol) {
+    return (size_t)(((u_int64_t)symbol * 0x9E3779B97F4A7C15ull) >> 32) & (ht->slot_capacity - 1);
+}
+
+/*Slot holding the symbol or the empty slot it would go in*/
+static size_t find_definition(HashTable* ht, Symbol symbol) {
+    size_t index = symbol_slot(ht, symbol);
+    STAT_ADD(table_lookups, 1);
+    while (ht->slots[index]) {
+        STAT_ADD(table_probes, 1);
+        if (ht->entries[ht->slots[index] - 1]->symbol == symbol) break;
+        index = (index + 1) & (ht->slot_capacity - 1);
+    }
+    return index;
+}
+
+static void grow_definitions(HashTable* ht) {
+    size_t capacity = ht->slot_capacity ? ht->slot_capacity * 2 : TABLE_SIZE;
+    u_int32_t* slots = calloc(capacity, sizeof(u_int32_t));
+    if (!slots) {
+        perror("Failed to allocate memory for varriable table");
+        exit(EXIT_FAILURE);
+    }
+    free(ht->slots);
+    ht->slots = slots;
+    ht->slot_capacity = capacity;
+
+    // Entries never move so the index is rebuilt from them
+    for (size_t i = 0; i < ht->count; i++) {
+        size_t index = symbol_slot(ht, ht->entries[i]->symbol);
+        while (ht->slots[index]) index = (index + 1) & (capacity - 1);
+        ht->slots[index] = i + 1;
+    }
+}
+
+HashVarriable** get_all_variable_entries(HashTable* ht, int* count) {
+    *count = ht->count;
     if (*count == 0) return NULL;  // No variables found
 
     // Allocate space for variable entries
@@ -100,233 +608,641 @@ HashVarriable** get_all_variable_entries(HashTable* ht, int* count) {
         perror("Failed to allocate memory for variable list");
         exit(EXIT_FAILURE);
     }
+    memcpy(entries, ht->entries, (*count) * sizeof(HashVarriable*));
+    return entries;  // Definitions in the order they were made
+}
 
-    int index = 0;
-    for (int i = 0; i < TABLE_SIZE; i++) {
-        HashVarriable* entry = ht->table[i];
-        while (entry) {
-            entries[index] = entry;  // Store the pointer to the entry
-            index++;
-            entry = entry->next;
-        }
-    }
+static void link_shape(HashTable* ht, HashVarriable* entry) {
+    HashVarriable** bucket = &ht->shapes[entry->value->hash % SHAPE_TABLE_SIZE];
+    entry->next_shape = *bucket;
+    *bucket = entry;
+}
 
-    return entries;  // Return list of `HashVarriable*`
+static void unlink_shape(HashTable* ht, HashVarriable* entry) {
+    HashVarriable** link = &ht->shapes[entry->value->hash % SHAPE_TABLE_SIZE];
+    while (*link != entry) link = &(*link)->next_shape;
+    *link = entry->next_shape;
 }
 
-void insert_variable(HashTable* ht, const char* name, BaseToken* value) {
-    unsigned int index = hash(name);
-    HashVarriable* entry = ht->table[index];
+void insert_variable(HashTable* ht, Symbol symbol, BaseToken* value) {
+    // Stored values outlive the command so they move to the table arena
+    value = clone_into(value, TABLE_ARENA);
+    // Cached normal forms of terms using the old value would never be looked up again
+    memo_invalidate(symbol);
+
+    ht->names |= NAME_BIT(symbol);
 
     // Check if variable already exists and replace it
-    while (entry) {
-        if (strcmp(entry->name, name) == 0) {
-            // Free old value and replace it
-            free_token(entry->value);  // Free previous BaseToken (if needed)
-            entry->value = value;
-            return;  // Exit after replacing
-        }
-        entry = entry->next;
+    if (ht->count * 2 >= ht->slot_capacity) grow_definitions(ht);
+    size_t index = find_definition(ht, symbol);
+    if (ht->slots[index]) {
+        HashVarriable* entry = ht->entries[ht->slots[index] - 1];
+        // Drop the old value, parts shared with other definitions stay
+        unlink_shape(ht, entry);
+        active_arena = TABLE_ARENA;
+        free_token(entry->value);
+        active_arena = command_arena;
+        entry->value = value;
+        link_shape(ht, entry);
+        // The old code is stale, the new value is compiled when it is next used
+        free_code(entry->code);
+        entry->code = NULL;
+        // The builtin was checked against the old value
+        entry->prim = 0;
+        return;  // Exit after replacing
     }
 
     // If not found, create a new variable entry
     HashVarriable* newVar = malloc(sizeof(HashVarriable));
-    newVar->name = strdup(name);
+    if (ht->count == ht->capacity) {
+        ht->capacity = ht->capacity ? ht->capacity * 2 : TABLE_SIZE;
+        ht->entries = realloc(ht->entries, ht->capacity * sizeof(HashVarriable*));
+    }
+    if (!newVar || !ht->entries) {
+        perror("Failed to allocate memory for varriable");
+        exit(EXIT_FAILURE);
+    }
+    newVar->symbol = symbol;
     newVar->value = value;
-    newVar->next = ht->table[index];  // Collision handling via chaining
-    ht->table[index] = newVar;
+    newVar->code = NULL;
+    newVar->prim = 0;
+    ht->entries[ht->count++] = newVar;
+    ht->slots[index] = ht->count;
+    link_shape(ht, newVar);
+}
+
+BaseToken* get_variable(HashTable* ht, Symbol symbol) {
+    HashVarriable* entry = get_variable_entry(ht, symbol);
+    return entry ? entry->value : NULL;  // NULL when the varriable isn't found
+}
+
+HashVarriable* get_variable_entry(HashTable* ht, Symbol symbol) {
+    if (ht->count == 0) return NULL;
+    size_t index = find_definition(ht, symbol);
+    return ht->slots[index] ? ht->entries[ht->slots[index] - 1] : NULL;
 }
 
-BaseToken* get_variable(HashTable* ht, const char* name) {
-    unsigned int index = hash(name);
-    HashVarriable* entry = ht->table[index];
-    while (entry) {
-        if (strcmp(entry->name, name) == 0)
-            return entry->value;
-        entry = entry->next;
+void free_table(HashTable* ht) {
+    active_arena = TABLE_ARENA;
+    for (size_t i = 0; i < ht->count; i++) {
+        free_token(ht->entries[i]->value);
+        free_code(ht->entries[i]->code);
+        free(ht->entries[i]);
     }
-    return NULL;  // Variable not found
+    active_arena = command_arena;
+    free(ht->entries);
+    free(ht->slots);
+    free(ht);
 }
 
-BaseToken* clone_base_token(BaseToken* token) {
-    if (!token) return NULL;  // Handle NULL input
+/*Names of the functions enclosing the token that is being parsed*/
+typedef struct ParseScope{
+    Symbol* names;
+    u_int32_t* shadowed; // Position plus one of the binder of the same name the function hides, 0 for none
+    size_t depth;
+    size_t capacity;
+    u_int32_t* bound; // Position plus one of the innermost binder of every symbol, 0 when it is free
+    size_t bound_capacity;
+} ParseScope;
+
+static void push_scope(ParseScope* scope, Symbol name){
+    if(scope->depth == scope->capacity){
+        scope->capacity = scope->capacity ? scope->capacity * 2 : 64;
+        scope->names = realloc(scope->names, scope->capacity * sizeof(Symbol));
+        scope->shadowed = realloc(scope->shadowed, scope->capacity * sizeof(u_int32_t));
+        if (!scope->names || !scope->shadowed) {
+            perror("Failed to allocate memory for scope");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if(name >= scope->bound_capacity){
+        size_t capacity = scope->bound_capacity ? scope->bound_capacity : 64;
+        while (capacity <= name) capacity *= 2;
+        scope->bound = realloc(scope->bound, capacity * sizeof(u_int32_t));
+        if (!scope->bound) {
+            perror("Failed to allocate memory for scope");
+            exit(EXIT_FAILURE);
+        }
+        memset(scope->bound + scope->bound_capacity, 0, (capacity - scope->bound_capacity) * sizeof(u_int32_t));
+        scope->bound_capacity = capacity;
+    }
+    scope->names[scope->depth] = name;
+    scope->shadowed[scope->depth] = scope->bound[name];
+    scope->depth++;
+    scope->bound[name] = scope->depth;
+}
 
-    // Allocate memory for the new token
-    BaseToken* newToken = malloc(sizeof(BaseToken));
-    if (!newToken) {
-        perror("Failed to allocate memory for new BaseToken");
-        exit(EXIT_FAILURE);
+static Symbol pop_scope(ParseScope* scope){
+    Symbol name = scope->names[--scope->depth];
+    scope->bound[name] = scope->shadowed[scope->depth];
+    return name;
+}
+
+/*Function or application being parsed, waiting for its body or its next value*/
+typedef struct ParseFrame{
+    u_int8_t type; // 1 function,2 application
+    size_t binders; // Varriables of the function
+    BaseToken* token; // Values of the application or the body combined so far
+    size_t values;
+} ParseFrame;
+
+/*Input of the parser and where it stopped when the text isn't a term*/
+typedef struct ParseInput{
+    const char* start;
+    const char* at;
+    const char* error; // Why the text isn't a term, NULL while it is
+} ParseInput;
+
+/*Syntax errors of the calling thread so far, def compares it to know whether its value could be read*/
+static __thread size_t syntax_errors;
+
+static int is_space(char c){
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+/*Names end at white space, parenthasis and the characters of a function head*/
+static size_t name_length(const char* text){
+    size_t len = 0;
+    while (text[len] && !is_space(text[len]) && text[len] != '(' && text[len] != ')' && text[len] != '\\' && text[len] != '.') len++;
+    return len;
+}
+
+static void skip_space(ParseInput* in){
+    while (is_space(*in->at)) in->at++;
+}
+
+static void report_syntax_error(ParseInput* in){
+    size_t line = 1;
+    size_t column = 1;
+    for (const char* c = in->start; c < in->at; c++){
+        if (*c == '\n'){
+            line++;
+            column = 1;
+        } else column++;
     }
+    fprintf(stderr, "Syntax error at line %zu column %zu of the term: %s\n", line, column, in->error);
+    syntax_errors++;
+}
 
-    // Copy primitive data
-    newToken->type = token->type;
-    newToken->var_len = token->var_len;
+/*Reads the term in one pass, the values of a parenthasis or a function body are applied left to right
+Returns NULL with the error set when the text isn't a term*/
+static BaseToken* parse_token(ParseInput* in, ParseScope* scope){
+    ParseFrame* frames = NULL;
+    size_t depth = 0;
+    size_t capacity = 0;
+    // The whole text is a sequence of values like the inside of a parenthasis
+    frames = grow_stack(frames, &capacity, sizeof(ParseFrame));
+    memset(&frames[depth++], 0, sizeof(ParseFrame));
+    frames[0].type = 2;
+
+    while (1){
+        skip_space(in);
+        char c = *in->at;
+        BaseToken* token = NULL;
+
+        if (c == '('){
+            in->at++;
+            skip_space(in);
+            if (depth == capacity) frames = grow_stack(frames, &capacity, sizeof(ParseFrame));
+            ParseFrame* frame = &frames[depth++];
+            memset(frame, 0, sizeof(ParseFrame));
+            frame->type = 2;
+            if (*in->at != '\\') continue;
+
+            in->at++;
+            frame->type = 1;
+            while (1){
+                skip_space(in);
+                if (*in->at == '.') break;
+                size_t len = name_length(in->at);
+                if (len == 0){
+                    in->error = *in->at && *in->at != ')' ? "expected the name of a varriable or ." : "missing . after the varriables";
+                    break;
+                }
+                push_scope(scope, intern_symbol(in->at, len));
+                in->at += len;
+                frame->binders++;
+            }
+            if (in->error) break;
+            if (frame->binders == 0){
+                in->error = "expected the name of a varriable";
+                break;
+            }
+            in->at++;
+            continue;
+        }
 
-    // Copy variable name (allocate memory first)
-    if (token->var_name) {
-        token->var_len = strlen(token->var_name);
-        newToken->var_name = malloc(token->var_len + 1); // +1 for null terminator
-        if (!newToken->var_name) {
-            perror("Failed to allocate memory for var_name");
-            exit(EXIT_FAILURE);
+        if (c == ')' || c == '\0'){
+            ParseFrame* frame = &frames[depth - 1];
+            if (c == ')' && depth == 1){
+                in->error = "unexpected )";
+                break;
+            }
+            if (c == '\0' && depth > 1){
+                in->error = "missing )";
+                break;
+            }
+            if (frame->values == 0){
+                // An empty line stays the empty name it always was
+                if (depth == 1){
+                    token = make_var(intern_symbol("", 0), 0);
+                    free(frames);
+                    return token;
+                }
+                in->error = frame->type == 1 ? "expected the body of the function" : "empty parenthasis";
+                break;
+            }
+            token = frame->token;
+            if (depth == 1){
+                free(frames);
+                return token;
+            }
+            in->at++;
+
+            // Tokens are built bottom up so the innermost function comes first
+            if (frame->type == 1){
+                for (size_t i = 0; i < frame->binders; i++) token = make_function(pop_scope(scope), token);
+            }
+            depth--;
+        } else if (c == '\\' || c == '.'){
+            in->error = c == '.' ? "unexpected ." : "a function needs a parenthasis around it";
+            break;
+        } else {
+            size_t len = name_length(in->at);
+            Symbol name = intern_symbol(in->at, len);
+            in->at += len;
+
+            // The innermost binder of the name is looked up directly instead of searching the enclosing functions
+            u_int32_t position = name < scope->bound_capacity ? scope->bound[name] : 0;
+            token = make_var(name, position ? scope->depth - position + 1 : 0);
         }
-        strncpy(newToken->var_name, token->var_name, token->var_len);
-        newToken->var_name[token->var_len] = '\0'; // Ensure null termination
-    } else {
-        newToken->var_name = NULL;
+
+        ParseFrame* frame = &frames[depth - 1];
+        frame->token = frame->values == 0 ? token : make_application(frame->token, token);
+        frame->values++;
     }
 
-    // Recursively clone children (if present)
-    for (int i = 0; i < 2; i++) {
-        newToken->in_values[i] = clone_base_token(token->in_values[i]);
+    // Tokens of the unfinished frames are dropped with the binders they opened
+    for (size_t i = depth; i > 0; i--){
+        free_token(frames[i - 1].token);
+        for (size_t j = 0; j < frames[i - 1].binders; j++) pop_scope(scope);
     }
+    free(frames);
+    return NULL;
+}
 
-    return newToken;
+void parse_str(char** input, BaseToken** token){
+    ParseScope scope = {0};
+    ParseInput in = {*input, *input, NULL};
+    *token = parse_token(&in, &scope);
+    if (!*token){
+        report_syntax_error(&in);
+        *token = make_var(intern_symbol("Syntax Error", strlen("Syntax Error")), 0);
+    }
+    *input = (char*)in.at;
+    free(scope.names);
+    free(scope.shadowed);
+    free(scope.bound);
 }
 
-void free_table(HashTable* ht) {
-    for (int i = 0; i < TABLE_SIZE; i++) {
-        HashVarriable* entry = ht->table[i];
-        while (entry) {
-            HashVarriable* temp = entry;
-            entry = entry->next;
-            free(temp->name);
-            free_token(temp->value);
-            free(temp);
+/*Names shown for the functions currently open while printing*/
+typedef struct PrintScope{
+    Symbol* free_names; // Names of the free varriables in the printed token
+    size_t free_count;
+    size_t free_capacity;
+    Symbol* names; // Name of every enclosing function
+    int* primes; // Number of ' added to the name so it doesn't capture another varriable
+    size_t* shadowed; // Depth plus one of the next enclosing function with the same name, 0 if there is none
+    PointerMap innermost; // Depth plus one of the innermost function with each name
+    size_t depth;
+    size_t capacity;
+    char* text; // Output kept until the whole token is printed, then written at once
+    size_t length;
+    size_t text_capacity;
+    size_t max_length; // Characters after which the rest is left out, 0 for no limit
+    u_int32_t max_depth; // Nesting below which parts are left out, 0 for no limit
+} PrintScope;
+
+static void collect_free_names(BaseToken* token, PrintScope* scope){
+    size_t base = walk.count;
+    push_walk(token, NULL, 0);
+    while (walk.count > base){
+        token = walk.frames[--walk.count].token;
+        if(token->names == 0) continue;
+        for (int i = 0; i < token->type; i++) push_walk(token->in_values[i], NULL, 0);
+        if(token->type != 0 || token->index != 0) continue;
+
+        int seen = 0;
+        for (size_t i = 0; i < scope->free_count && !seen; i++){
+            if(scope->free_names[i] == token->symbol) seen = 1;
         }
+        if (seen) continue;
+        if(scope->free_count == scope->free_capacity){
+            scope->free_capacity = scope->free_capacity ? scope->free_capacity * 2 : 16;
+            scope->free_names = realloc(scope->free_names, scope->free_capacity * sizeof(Symbol));
+        }
+        scope->free_names[scope->free_count++] = token->symbol;
     }
-    free(ht);
 }
 
-void parse_str(char** input, BaseToken** token){
-    if ((*input)[0] == '('){
-        if((*input)[1] == '\\'){
-            (*input) += 2;
-            while (strcspn(*input, " ") < strcspn(*input, "."))
-            {
-                (*token)->type = 1;
-                (*token)->var_len = strcspn(*input, " ");
-                (*token)->var_name = malloc(sizeof(char) * (*token)->var_len + 1);
-                strncpy((*token)->var_name, *input, (*token)->var_len);
-                (*token)->var_name[(*token)->var_len] = '\0';
-                *input += (*token)->var_len + 1;
-                (*token)->in_values[0] = malloc(sizeof(BaseToken));
-                memset((*token)->in_values[0], 0, sizeof(BaseToken)); 
-                token = &(*token)->in_values[0];
-            }
-            
-
-            (*token)->type = 1;
-            (*token)->var_len = strcspn(*input, ".");
-            (*token)->var_name = malloc(sizeof(char) * (*token)->var_len + 1);
-            strncpy((*token)->var_name, *input, (*token)->var_len);
-            (*token)->var_name[(*token)->var_len] = '\0';
-            
-            *input += (*token)->var_len + 1;
-            (*token)->in_values[0] = malloc(sizeof(BaseToken));
-            memset((*token)->in_values[0], 0, sizeof(BaseToken)); 
-            parse_str(input, &(*token)->in_values[0]);
-            (*input)++; // Skip parenthasis at the end
-        }else{
-            (*input)++;
-            (*token)->type = 2;
-            (*token)->in_values[0] = malloc(sizeof(BaseToken));
-            memset((*token)->in_values[0], 0, sizeof(BaseToken)); 
-            (*token)->in_values[1] = malloc(sizeof(BaseToken));
-            memset((*token)->in_values[1], 0, sizeof(BaseToken)); 
-            parse_str(input, &(*token)->in_values[0]);
-            parse_str(input, &(*token)->in_values[1]);
-            while ((*input)[0] != ')')
-            {
-                BaseToken* parentToken = malloc(sizeof(BaseToken));
-                memset(parentToken, 0, sizeof(BaseToken));
-                parentToken->type = 2;
-                parentToken->in_values[0] = *token;
-                parentToken->in_values[1] = malloc(sizeof(BaseToken));
-                memset(parentToken->in_values[1], 0, sizeof(BaseToken));
-                parse_str(input, &parentToken->in_values[1]);
-                (*token) = parentToken;
+static int token_uses(BaseToken* token, u_int32_t index, Symbol name){
+    size_t base = walk.count;
+    push_walk(token, NULL, index);
+    while (walk.count > base){
+        WalkFrame frame = walk.frames[--walk.count];
+        token = frame.token;
+        index = frame.depth;
+
+        // Index 0 looks for the free name, otherwise for the varriable bound index functions above the token
+        if(index != 0 && token->loose < index) continue;
+        if(index == 0 && !(token->names & NAME_BIT(name))) continue;
+        if(token->type == 0){
+            if (token->index == index && (index != 0 || token->symbol == name)){
+                walk.count = base;
+                return 1;
             }
-            
-            (*input)++;
+        } else if(token->type == 1){
+            push_walk(token->in_values[0], NULL, index ? index + 1 : 0);
+        } else {
+            push_walk(token->in_values[1], NULL, index);
+            push_walk(token->in_values[0], NULL, index);
         }
-    }else{
-        (*token)->type = 0;
-        (*token)->var_len = strcspn(*input, " ()");
-        (*token)->var_name = malloc(sizeof(char) * (*token)->var_len + 1);
-        strncpy((*token)->var_name, *input, (*token)->var_len);
-        (*token)->var_name[(*token)->var_len] = '\0';
-        (*input) += (*token)->var_len;
-        while(**input == ' ') (*input)++;
     }
+    return 0;
 }
 
-void print_parse(BaseToken* token){
-    char* varName;
-    if(token->type == 1 || token->type == 0){
-        int varLen = strcspn(token->var_name, ":");
-        varName = malloc(sizeof(char) * varLen + 1);
-        strncpy(varName, token->var_name, varLen);
-        varName[varLen] = '\0';
-    }
-    if(token->type == 1){
-        printf("(\\%s.",varName);
-        print_parse(token->in_values[0]);
-        printf(")");
-    }
-    if(token->type == 0){
-        printf("%s",varName);
-    }
-    if(token->type == 2){
-        printf("(");
-        print_parse(token->in_values[0]);
-        if(token->in_values[0]->type == 0 && token->in_values[1]->type == 0) printf(" ");
-        print_parse(token->in_values[1]);
-        printf(")");
-    }
-}
-
-int add_recursive_suffix(BaseToken* token, char* suffix){
-    int ret = 0;
-    if(token->type == 0 || token->type == 1){
-        size_t original_len = strlen(token->var_name);
-        size_t suffix_len = strlen(suffix);
-        size_t new_len = original_len + suffix_len + 1;
-
-        char* new_var_name = realloc(token->var_name, new_len);
-        if (!new_var_name) {
-            perror("Memory allocation failed");
-            exit(EXIT_FAILURE);
+static int name_in_use(PrintScope* scope, BaseToken* body, Symbol name, int primes){
+    if(primes == 0){
+        for (size_t i = 0; i < scope->free_count; i++){
+            if(scope->free_names[i] == name && token_uses(body, 0, name)) return 1;
         }
-    
-        token->var_name = new_var_name;
-        strcat(token->var_name, suffix);
-        ret = 1;
     }
+    // Shadowing is only a problem when the body still uses the outer function
+    for (size_t i = (uintptr_t)pointer_map_get(&scope->innermost, (void*)(uintptr_t)name); i > 0; i = scope->shadowed[i - 1]){
+        if(scope->primes[i - 1] == primes && token_uses(body, scope->depth - i + 2, 0)) return 1;
+    }
+    return 0;
+}
 
-    for (int i = 0; i < token->type; i++){
-        if (add_recursive_suffix(token->in_values[i], suffix))
-            ret = 1;
+static void print_text(PrintScope* scope, const char* text, size_t length){
+    if (scope->length + length > scope->text_capacity){
+        scope->text_capacity = scope->text_capacity ? scope->text_capacity * 2 : 256;
+        if (scope->text_capacity < scope->length + length) scope->text_capacity = scope->length + length;
+        scope->text = realloc(scope->text, scope->text_capacity);
+        if (!scope->text) {
+            perror("Failed to allocate memory for output");
+            exit(EXIT_FAILURE);
+        }
     }
-    return ret;
+    memcpy(scope->text + scope->length, text, length);
+    scope->length += length;
+}
+
+static void print_char(PrintScope* scope, char c){
+    if (scope->length < scope->text_capacity) scope->text[scope->length++] = c;
+    else print_text(scope, &c, 1);
+}
+
+static void print_name(PrintScope* scope, Symbol name, int primes){
+    const char* text = symbol_name(name);
+    print_text(scope, text, strlen(text));
+    for (int i = 0; i < primes; i++) print_char(scope, '\'');
 }
 
-int beta_reduction_rec(BaseToken** token, char* varriable, BaseToken* value){
-    if((*token)->type == 0){
-        //printf("Testing %s == %s result %d\n",varriable, (*token)->var_name, strcmp(varriable, (*token)->var_name) == 0);
-        if (strcmp(varriable, (*token)->var_name) == 0){
-            free_token(*token);
+static void print_token(BaseToken* token, PrintScope* scope){
+    size_t base = walk.count;
+    push_walk(token, NULL, 0);
+
+    while (walk.count > base){
+        WalkFrame* frame = &walk.frames[walk.count - 1];
+        token = frame->token;
+
+        // Whatever is past the limits is printed as ...
+        if(scope->max_length && scope->length >= scope->max_length){
+            scope->length = scope->max_length;
+            print_text(scope, "...", 3);
+            walk.count = base;
+            break;
+        }
+        if(frame->state == 0 && scope->max_depth && walk.count - base > scope->max_depth){
+            walk.count--;
+            print_text(scope, "...", 3);
+            continue;
+        }
+
+        if(token->type == 0){
+            walk.count--;
+            if(token->index == 0 || token->index > scope->depth){
+                print_name(scope, token->symbol, 0);
+            }else{
+                size_t binder = scope->depth - token->index;
+                print_name(scope, scope->names[binder], scope->primes[binder]);
+            }
+            continue;
+        }
+
+        if(token->type == 1){
+            if(frame->state == 1){
+                walk.count--;
+                print_char(scope, ')');
+                scope->depth--;
+                pointer_map_put(&scope->innermost, (void*)(uintptr_t)token->symbol, (void*)(uintptr_t)scope->shadowed[scope->depth]);
+                continue;
+            }
+            frame->state = 1;
+
+            // Rename the function when its name would capture another varriable
+            int primes = 0;
+            while (name_in_use(scope, token->in_values[0], token->symbol, primes)) primes++;
+
+            if(scope->depth == scope->capacity){
+                scope->capacity = scope->capacity ? scope->capacity * 2 : 64;
+                scope->names = realloc(scope->names, scope->capacity * sizeof(Symbol));
+                scope->primes = realloc(scope->primes, scope->capacity * sizeof(int));
+                scope->shadowed = realloc(scope->shadowed, scope->capacity * sizeof(size_t));
+            }
+            scope->names[scope->depth] = token->symbol;
+            scope->primes[scope->depth] = primes;
+            scope->shadowed[scope->depth] = (uintptr_t)pointer_map_get(&scope->innermost, (void*)(uintptr_t)token->symbol);
+            scope->depth++;
+            pointer_map_put(&scope->innermost, (void*)(uintptr_t)token->symbol, (void*)(uintptr_t)scope->depth);
+
+            print_text(scope, "(\\", 2);
+            print_name(scope, token->symbol, primes);
+            print_char(scope, '.');
+            push_walk(token->in_values[0], NULL, 0);
+            continue;
+        }
 
-            (*token) = clone_base_token(value);
+        if(frame->state == 0){
+            print_char(scope, '(');
+            frame->state = 1;
+            push_walk(token->in_values[0], NULL, 0);
+        } else if(frame->state == 1){
+            // Two varriables or two left out parts need a space between them
+            int elided = scope->max_depth && walk.count - base >= scope->max_depth;
+            if(elided || (token->in_values[0]->type == 0 && token->in_values[1]->type == 0)) print_char(scope, ' ');
+            frame->state = 2;
+            push_walk(token->in_values[1], NULL, 0);
+        } else {
+            walk.count--;
+            print_char(scope, ')');
         }
     }
-    else{
-        for (int i = 0; i < (*token)->type; i++){
-            beta_reduction_rec(&((*token)->in_values[i]), varriable, value);
+}
+
+/*Closed parts of a printed token reached from more than one parent, bound once in front of it*/
+typedef struct PrintSharing{
+    PointerMap uses; // Parents of every token reached so far
+    PointerMap binders; // Position plus one of every bound part
+    BaseToken** parts; // Every token in post order, then only the bound parts, inner parts come first
+    size_t count;
+    size_t capacity;
+    Symbol* names; // Name of the binder of every bound part
+    BaseToken* root; // Part being rewritten, it is not replaced by its own binder
+    u_int32_t bound; // Binders in front of the part being rewritten
+} PrintSharing;
+
+static void find_shared_parts(BaseToken* token, PrintSharing* sharing){
+    size_t base = walk.count;
+    push_walk(token, NULL, 0);
+    while (walk.count > base){
+        WalkFrame* frame = &walk.frames[walk.count - 1];
+        token = frame->token;
+        if(frame->state == 0){
+            // Tokens smaller than the limit hold no part, the others are only walked the first time they are reached
+            size_t uses = token->size < PRINT_SHARE_SIZE ? 0 : (uintptr_t)pointer_map_get(&sharing->uses, token) + 1;
+            if(uses) pointer_map_put(&sharing->uses, token, (void*)(uintptr_t)uses);
+            if(uses != 1){
+                walk.count--;
+                continue;
+            }
+        }
+        if(frame->state < token->type){
+            push_walk(token->in_values[frame->state++], NULL, 0);
+            continue;
         }
+        walk.count--;
+        if(sharing->count == sharing->capacity)
+            sharing->parts = grow_stack(sharing->parts, &sharing->capacity, sizeof(BaseToken*));
+        sharing->parts[sharing->count++] = token;
     }
-    
-    return 1;
+
+    size_t count = 0;
+    for (size_t i = 0; i < sharing->count; i++){
+        token = sharing->parts[i];
+        if(token->loose != 0 || (uintptr_t)pointer_map_get(&sharing->uses, token) < 2) continue;
+        sharing->parts[count++] = token;
+        pointer_map_put(&sharing->binders, token, (void*)(uintptr_t)count);
+    }
+    sharing->count = count;
+}
+
+static BaseToken* share_visit(BaseToken* token, u_int32_t depth, void* data){
+    PrintSharing* sharing = data;
+    if(token->size < PRINT_SHARE_SIZE) return retain_token(token);
+    if(token == sharing->root) return NULL;
+    size_t binder = (uintptr_t)pointer_map_get(&sharing->binders, token);
+    if(binder == 0) return NULL;
+    return make_var(sharing->names[binder - 1], depth + sharing->bound - binder + 1);
+}
+
+/*Rewrites the token as ((\s1.((\s2.token) part2)) part1) with every bound part replaced by its name*/
+static BaseToken* share_parts(BaseToken* token){
+    PrintSharing sharing;
+    memset(&sharing, 0, sizeof(PrintSharing));
+    find_shared_parts(token, &sharing);
+    if(sharing.count == 0){
+        free(sharing.parts);
+        pointer_map_free(&sharing.uses);
+        pointer_map_free(&sharing.binders);
+        return retain_token(token);
+    }
+
+    sharing.names = malloc(sharing.count * sizeof(Symbol));
+    if (!sharing.names) {
+        perror("Failed to allocate memory for shared parts");
+        exit(EXIT_FAILURE);
+    }
+    char name[32];
+    for (size_t i = 0; i < sharing.count; i++){
+        snprintf(name, sizeof(name), "s%zu", i + 1);
+        sharing.names[i] = intern_symbol(name, strlen(name));
+    }
+
+    sharing.bound = sharing.count;
+    BaseToken* result = rewrite_token(token, 0, share_visit, NULL, &sharing);
+    for (size_t i = sharing.count; i > 0; i--){
+        sharing.root = sharing.parts[i - 1];
+        sharing.bound = i - 1;
+        BaseToken* value = rewrite_token(sharing.root, 0, share_visit, NULL, &sharing);
+        result = make_application(make_function(sharing.names[i - 1], result), value);
+    }
+    free(sharing.names);
+    free(sharing.parts);
+    pointer_map_free(&sharing.uses);
+    pointer_map_free(&sharing.binders);
+    return result;
+}
+
+void print_parse(BaseToken* token){
+    fprint_parse(stdout, token);
+}
+
+void fprint_parse(FILE* out, BaseToken* token){
+    fprint_limited(out, token, NULL);
+}
+
+void fprint_limited(FILE* out, BaseToken* token, PrintOptions* options){
+    PrintScope scope;
+    memset(&scope, 0, sizeof(PrintScope));
+    if (options) {
+        scope.max_length = options->max_length;
+        scope.max_depth = options->max_depth;
+    }
+    token = options && options->share ? share_parts(token) : retain_token(token);
+    collect_free_names(token, &scope);
+    print_token(token, &scope);
+    fwrite(scope.text, 1, scope.length, out);
+    free_token(token);
+    free(scope.text);
+    free(scope.free_names);
+    free(scope.names);
+    free(scope.primes);
+    free(scope.shadowed);
+    pointer_map_free(&scope.innermost);
+}
+
+static BaseToken* shift_visit(BaseToken* token, u_int32_t cutoff, void* d){
+    // Nothing inside points above the cutoff so the token can be shared as is
+    if(token->loose <= cutoff) return retain_token(token);
+    if(token->type == 0) {
+        STAT_ADD(shifted, 1);
+        return make_var(token->symbol, token->index + *(int*)d);
+    }
+    return NULL;
+}
+
+BaseToken* shift_indices(BaseToken* token, int d, u_int32_t cutoff){
+    return rewrite_token(token, cutoff, shift_visit, NULL, &d);
+}
+
+static BaseToken* substitute_visit(BaseToken* token, u_int32_t depth, void* value){
+    // Neither the replaced varriable nor any outer one is used inside
+    if(token->loose < depth) return retain_token(token);
+    if(token->type != 0) return NULL;
+
+    // The value moves under the functions in between so its outer indices are shifted past them
+    if (token->index == depth) {
+        STAT_ADD(substitutions, 1);
+        return shift_indices(value, depth - 1, 0);
+    }
+    // Varriables bound outside of the removed function lose one level
+    return make_var(token->symbol, token->index - 1);
+}
+
+BaseToken* beta_reduction_rec(BaseToken* token, u_int32_t depth, BaseToken* value){
+    return rewrite_token(token, depth, substitute_visit, NULL, value);
 }
 
 void beta_reduction(BaseToken** token){
@@ -337,63 +1253,206 @@ void beta_reduction(BaseToken** token){
 
     if (!func) return;
 
-    beta_reduction_rec(&func->in_values[0], func->var_name, value);
+    // Only the paths to the replaced varriable are rebuilt, everything else is shared
+    BaseToken* body = beta_reduction_rec(func->in_values[0], 1, value);
+    STAT_ADD(beta_steps, 1);
+    free_token(*token);
+    *token = body;
+}
+
+int beta_reduction_search(BaseToken** token){
+    // Depth first search for the leftmost outermost redex, the frames are the path down to it
+    // Two clock reads per step cost more than the counters, they are only taken under --verbose
+    u_int64_t start = stats_timing ? stats_clock() : 0;
+    u_int64_t visits = 1;
+    size_t base = walk.count;
+    push_walk(*token, NULL, 0);
+    while (walk.count > base){
+        WalkFrame* frame = &walk.frames[walk.count - 1];
+        BaseToken* current = frame->token;
+        if(frame->state == 0 && current->type == 2 && current->in_values[0]->type == 1) break;
+        if(frame->state < current->type){
+            push_walk(current->in_values[frame->state++], NULL, 0);
+            visits++;
+            continue;
+        }
+        walk.count--;
+    }
+    STAT_ADD(search_visits, visits);
+    if (stats_timing) start = stats_phase(PHASE_SEARCH, start);
+    if (walk.count == base) return 0;
+
+    BaseToken* result = retain_token(walk.frames[--walk.count].token);
+    beta_reduction(&result);
+
+    // Rebuild the path around the reduced child, everything else is shared
+    while (walk.count > base){
+        WalkFrame* frame = &walk.frames[--walk.count];
+        BaseToken* current = frame->token;
+        if (current->type == 1) result = make_function(current->symbol, result);
+        else if (frame->state == 1) result = make_application(result, retain_token(current->in_values[1]));
+        else result = make_application(retain_token(current->in_values[0]), result);
+    }
+    free_token(*token);
+    *token = result;
+    stats_max_size(result->size);
+    if (stats_timing) stats_phase(PHASE_SUBSTITUTE, start);
+    return 1;
+}
+
+/*Token of the frame with the children it has now, the references of the frame are taken over*/
+static BaseToken* rebuild_frame(ReduceFrame* frame){
+    BaseToken* token = frame->token;
+    if (frame->in_values[0] == token->in_values[0] && frame->in_values[1] == token->in_values[1]){
+        free_token(frame->in_values[0]);
+        free_token(frame->in_values[1]);
+        return token;
+    }
+    BaseToken* result = token->type == 1 ? make_function(token->symbol, frame->in_values[0]) :
+        make_application(frame->in_values[0], frame->in_values[1]);
+    free_token(token);
+    return result;
+}
+
+/*Moves the focus to the child being searched of the token*/
+static void enter_focus(Reducer* reducer){
+    if (reducer->count == reducer->capacity) reducer->frames = grow_stack(reducer->frames, &reducer->capacity, sizeof(ReduceFrame));
+    BaseToken* token = reducer->focus;
+    ReduceFrame* frame = &reducer->frames[reducer->count++];
+    frame->token = token;
+    frame->in_values[0] = NULL;
+    frame->in_values[1] = retain_token(token->in_values[1]);
+    frame->state = 0;
+    reducer->focus = retain_token(token->in_values[0]);
+}
 
-    free_token(value);
+/*Moves the focus to its parent, which is rebuilt around it*/
+static void leave_focus(Reducer* reducer){
+    ReduceFrame* frame = &reducer->frames[--reducer->count];
+    frame->in_values[frame->state] = reducer->focus;
+    reducer->focus = rebuild_frame(frame);
+}
 
-    // Assign cloned token
-    *token = func->in_values[0];
+void reducer_start(Reducer* reducer, BaseToken* token, HashTable* table){
+    memset(reducer, 0, sizeof(Reducer));
+    reducer->focus = token;
+    reducer->table = table;
 }
 
-int beta_reduction_search(BaseToken** token){
-    if((*token)->type == 2){
-        if((*token)->in_values[0]->type == 1){
-            beta_reduction(token);
-            return 1;
+int reducer_step(Reducer* reducer){
+    u_int64_t start = stats_timing ? stats_clock() : 0;
+    u_int64_t visits = 0;
+
+    // Only the parent can have become a redex, when the last step left a function in the place of its function
+    if (reducer->contracted && reducer->count > 0 && reducer->focus->type == 1){
+        ReduceFrame* frame = &reducer->frames[reducer->count - 1];
+        if (frame->token->type == 2 && frame->state == 0) leave_focus(reducer);
+    }
+    reducer->contracted = 0;
+
+    BaseToken* value = NULL;
+    while (1){
+        BaseToken* current = reducer->focus;
+        if (!reducer->normal){
+            visits++;
+            if (current->type == 2 && current->in_values[0]->type == 1) break;
+            if (reducer->table && current->type == 0 && current->index == 0 && (value = get_variable(reducer->table, current->symbol))) break;
+            if (current->type > 0){
+                enter_focus(reducer);
+                continue;
+            }
+            reducer->normal = 1;
         }
-        int out = beta_reduction_search(&(*token)->in_values[0]);
-        if (out == 0)
-            out = beta_reduction_search(&(*token)->in_values[1]);
-        return out;
-    }    
-    if((*token)->type == 1)
-        return beta_reduction_search(&(*token)->in_values[0]);
-    return 0;
+
+        // The focus has no redex, the search goes on right of it or above it
+        if (reducer->count == 0){
+            STAT_ADD(search_visits, visits);
+            if (stats_timing) stats_phase(PHASE_SEARCH, start);
+            return 0;
+        }
+        ReduceFrame* frame = &reducer->frames[reducer->count - 1];
+        if (frame->token->type == 2 && frame->state == 0){
+            frame->in_values[0] = reducer->focus;
+            frame->state = 1;
+            reducer->focus = frame->in_values[1];
+            frame->in_values[1] = NULL;
+            reducer->normal = 0;
+            continue;
+        }
+        leave_focus(reducer);
+    }
+    STAT_ADD(search_visits, visits);
+    if (stats_timing) start = stats_phase(PHASE_SEARCH, start);
+
+    if (value){
+        free_token(reducer->focus);
+        reducer->focus = retain_token(value);
+        STAT_ADD(unfolds, 1);
+    } else {
+        beta_reduction(&reducer->focus);
+    }
+    reducer->contracted = 1;
+    if (stats_timing) stats_phase(PHASE_SUBSTITUTE, start);
+    return 1;
+}
+
+BaseToken* reducer_finish(Reducer* reducer){
+    while (reducer->count > 0) leave_focus(reducer);
+    BaseToken* token = reducer->focus;
+    free(reducer->frames);
+    memset(reducer, 0, sizeof(Reducer));
+    stats_max_size(token->size);
+    return token;
 }
 
 void print_map_varriables(HashTable* table){
     int count;
     HashVarriable** varriables = get_all_variable_entries(table, &count);
     for(int i =0; i< count; i++){
-        printf("%s    ", varriables[i]->name);
+        printf("%s    ", symbol_name(varriables[i]->symbol));
         print_parse(varriables[i]->value);
         printf("\n");
     }
+    free(varriables);
 }
 
-int expand_varriable(BaseToken** token, HashTable* table){
-    int ret = 0;
+/*State of a rewrite against the definitions*/
+typedef struct TableRewrite{
+    HashTable* table;
+    PointerMap done; // Results of shared tokens
+    int out; // Something was replaced
+} TableRewrite;
+
+static BaseToken* expand_visit(BaseToken* token, u_int32_t depth, void* data){
+    (void)depth;
+    TableRewrite* rewrite = data;
+    // Parts without a defined free name stay as they are, closed ones and the definitions themselves mostly
+    if (!(token->names & rewrite->table->names)) return retain_token(token);
+    BaseToken* known = pointer_map_get(&rewrite->done, token);
+    if (known) return retain_token(known);
+
+    // Only free names refer to the table, definitions keep their own indices so no renaming is needed
+    if(token->type != 0 || token->index != 0) return NULL;
+    BaseToken* var = get_variable(rewrite->table, token->symbol);
+    if (var == NULL) return NULL;
+
+    // The definition is shared instead of copied
+    rewrite->out = 1;
+    return retain_token(var);
+}
 
-    
-    for (int i = 0; i < (*token)->type; i++){
-        if (expand_varriable(&((*token)->in_values[i]), table))
-            ret = 1;
-    }
+static void remember_table_rewrite(BaseToken* token, BaseToken* result, void* data){
+    pointer_map_put(&((TableRewrite*)data)->done, token, result);
+}
 
-    if((*token)->type == 0){
-        int varLen = strcspn((*token)->var_name, ":");
-        char* varName = malloc(sizeof(char) * varLen + 1);
-        strncpy(varName, (*token)->var_name, varLen);
-        varName[varLen] = '\0';
-        BaseToken* var = get_variable(table, varName);
-        if (var != NULL){
-            free_token(*token);
-            (*token) = clone_base_token(var);
-            add_recursive_suffix((*token), generate_random_string(':',16));
-            ret = 1;
-        }
-    }
-    return ret;
+int expand_varriable(BaseToken** token, HashTable* table){
+    TableRewrite rewrite = {table, {0}, 0};
+    BaseToken* result = rewrite_token(*token, 0, expand_visit, remember_table_rewrite, &rewrite);
+    pointer_map_free(&rewrite.done);
+
+    free_token(*token);
+    *token = result;
+    return rewrite.out;
 }
 
 void remove_newline(char* str) {
@@ -403,75 +1462,378 @@ void remove_newline(char* str) {
     }
 }
 
-void execute_file(const char* filename, HashTable* table) {
-    FILE* file = fopen(filename, "r");
-    if (!file) {
-        perror("Error opening file");
+/*br lines that start, continue or list sessions change them like a definition changes the table*/
+static int uses_session(const char* line) {
+    line += 2;
+    while (1) {
+        while (*line == ' ') line++;
+        if (strncmp(line, "--", 2) != 0) break;
+        if (strncmp(line, "--session", 9) == 0) return 1;
+        int value = strncmp(line, "--time", 6) == 0 || strncmp(line, "--mem", 5) == 0;
+        line += strcspn(line, " ");
+        if (value) {
+            while (*line == ' ') line++;
+            line += strcspn(line, " ");
+        }
+    }
+    return strncmp(line, "continue", 8) == 0 || strncmp(line, "sessions", 8) == 0 || strncmp(line, "drop", 4) == 0;
+}
+
+/*Only these lines run on the worker pool, everything else can change the table or print by itself*/
+static int is_query(const char* line) {
+    size_t length = strcspn(line, " =");
+    if (*line == '(') return 1;
+    return (length == 2 && strncmp(line, "br", 2) == 0 && !uses_session(line)) || (length == 2 && strncmp(line, "ex", 2) == 0) ||
+        (length == 3 && strncmp(line, "run", 3) == 0) ||
+        (length == 3 && strncmp(line, "con", 3) == 0) || (length == 4 && strncmp(line, "eval", 4) == 0);
+}
+
+/*Set from --verbose, every result is followed by the counters of its command*/
+static int verbose_stats;
+
+/*Set from the print options, limits and sharing of every printed result*/
+static PrintOptions print_options;
+
+/*Prints the result of a command and ends its counters*/
+static void print_result(FILE* out, BaseToken* token) {
+    if (token != NULL) {
+        u_int64_t start = stats_clock();
+        fprint_limited(out, token, &print_options);
+        putc('\n', out);
+        stats_phase(PHASE_PRINT, start);
+        stats_max_size(token->size);
+    }
+    if (verbose_stats) print_stats(out, &command_stats, 1);
+    stats_end_command();
+}
+
+static void run_query(size_t index, void* data) {
+    BatchRun* run = data;
+    FILE* out = open_memstream(&run->outputs[index], &run->output_sizes[index]);
+    if (!out) {
+        perror("Failed to open output buffer");
+        exit(EXIT_FAILURE);
+    }
+    BaseToken* token = command_interpeter(run->lines[index], run->table);
+    print_result(out, token);
+    fclose(out);
+    end_command();
+}
+
+/*Runs the waiting query lines on the pool and writes their results in input order*/
+static void flush_batch(BatchRun* run) {
+    if (!run || run->pending == 0) return;
+    pool_run(run->pool, run->pending, run_query, run);
+    for (size_t i = 0; i < run->pending; i++) {
+        fwrite(run->outputs[i], 1, run->output_sizes[i], stdout);
+        free(run->outputs[i]);
+        free(run->lines[i]);
+    }
+    run->pending = 0;
+}
+
+static void queue_query(BatchRun* run, const char* line) {
+    if (run->pending == run->capacity) {
+        run->capacity = run->capacity ? run->capacity * 2 : 256;
+        run->lines = realloc(run->lines, run->capacity * sizeof(char*));
+        run->outputs = realloc(run->outputs, run->capacity * sizeof(char*));
+        run->output_sizes = realloc(run->output_sizes, run->capacity * sizeof(size_t));
+        if (!run->lines || !run->outputs || !run->output_sizes) {
+            perror("Failed to allocate memory for batch");
+            exit(EXIT_FAILURE);
+        }
+    }
+    run->lines[run->pending] = strdup(line);
+    if (!run->lines[run->pending]) {
+        perror("Failed to allocate memory for batch");
         exit(EXIT_FAILURE);
     }
+    run->pending++;
+    if (run->pending >= BATCH_QUEUE_SIZE) flush_batch(run);
+}
 
+/*Runs one line, printing its result in a batch run, returns 0 when the line asks to stop*/
+static int run_line(char* line, HashTable* table, BatchRun* run) {
+    if (run) {
+        run->commands++;
+        // Queries between two other lines don't depend on each other, the other lines wait for them
+        if (run->pool && is_query(line)) {
+            queue_query(run, line);
+            return 1;
+        }
+        flush_batch(run);
+        if (strcmp(line, "exit") == 0) return 0;
+    }
+    BaseToken* token = command_interpeter(line, table);
+    // Lines of a loaded file count as part of the load command
+    if (run) print_result(stdout, token);
+    // Everything the command allocated is released at once
+    end_command();
+    return 1;
+}
+
+/*Parenthasis the text leaves open, a term goes on on the next line while some are*/
+static long open_parenthasis(const char* text, size_t length) {
+    long open = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (text[i] == '(') open++;
+        else if (text[i] == ')') open--;
+    }
+    return open;
+}
+
+/*Runs the lines of a mapped file, each newline is overwritten in the private mapping to end its line*/
+static int run_mapped(char* data, size_t size, HashTable* table, BatchRun* run) {
+    char* end = data + size;
+    while (data < end) {
+        char* newline = memchr(data, '\n', end - data);
+        // The newlines inside an unfinished term stay in the line, the parser reads them as spaces
+        long open = open_parenthasis(data, (newline ? newline : end) - data);
+        while (open > 0 && newline) {
+            char* next = memchr(newline + 1, '\n', end - newline - 1);
+            open += open_parenthasis(newline + 1, (next ? next : end) - newline - 1);
+            newline = next;
+        }
+        char* line = data;
+        if (run) run->bytes += (newline ? newline + 1 : end) - data;
+        char* last = NULL;
+        if (newline) {
+            *newline = '\0';
+            data = newline + 1;
+        } else {
+            // The last line has no newline to overwrite, there may be no room after it in the mapping
+            last = malloc(end - data + 1);
+            if (!last) {
+                perror("Failed to allocate memory for line");
+                exit(EXIT_FAILURE);
+            }
+            memcpy(last, data, end - data);
+            last[end - data] = '\0';
+            line = last;
+            data = end;
+        }
+        int go_on = run_line(line, table, run);
+        free(last);
+        if (!go_on) return 0;
+    }
+    return 1;
+}
+
+/*Runs the lines of a stream that can't be mapped like a pipe*/
+static int run_stream(FILE* file, HashTable* table, BatchRun* run) {
     char* line = NULL;  // Pointer for dynamic allocation
     size_t len = 0;     // Stores allocated buffer size
     ssize_t read;       // Stores the length of the read line
-
-    while ((read = getline(&line, &len, file)) != -1) {
+    int go_on = 1;
+
+    char* more = NULL;  // Next line of a term left unfinished
+    size_t more_len = 0;
+
+    while (go_on && (read = getline(&line, &len, file)) != -1) {
+        if (run) run->bytes += read;
+        long open = open_parenthasis(line, read);
+        while (open > 0) {
+            ssize_t extra = getline(&more, &more_len, file);
+            if (extra == -1) break;
+            if (run) run->bytes += extra;
+            open += open_parenthasis(more, extra);
+            if ((size_t)(read + extra + 1) > len) {
+                len = read + extra + 1;
+                line = realloc(line, len);
+                if (!line) {
+                    perror("Failed to allocate memory for line");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            memcpy(line + read, more, extra + 1);
+            read += extra;
+        }
         remove_newline(line);
-        BaseToken* token = command_interpeter(line, table);
-        if(token != NULL) free_token(token);
+        go_on = run_line(line, table, run);
     }
 
+    free(more);
     free(line);  // Free allocated memory
+    return go_on;
+}
+
+static int read_input(const char* filename, HashTable* table, BatchRun* run) {
+    int fd = strcmp(filename, "-") == 0 ? STDIN_FILENO : open(filename, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        fprintf(stderr, "Error opening file %s: %s\n", filename, strerror(errno));
+        if (fd > STDIN_FILENO) close(fd);
+        return -1;
+    }
+
+    // Regular files are mapped privately so lines can be ended in place without copying them
+    if (S_ISREG(info.st_mode) && info.st_size > 0) {
+        char* data = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            madvise(data, info.st_size, MADV_SEQUENTIAL);
+            int go_on = run_mapped(data, info.st_size, table, run);
+            munmap(data, info.st_size);
+            if (fd != STDIN_FILENO) close(fd);
+            return go_on;
+        }
+    }
+
+    if (fd == STDIN_FILENO) return run_stream(stdin, table, run);
+    FILE* file = fdopen(fd, "r");
+    if (!file) {
+        perror("Error opening file");
+        close(fd);
+        return -1;
+    }
+    int go_on = run_stream(file, table, run);
     fclose(file);
+    return go_on;
+}
+
+int execute_input(const char* filename, HashTable* table, BatchRun* run) {
+    int go_on = read_input(filename, table, run);
+    flush_batch(run);
+    return go_on;
+}
+
+int execute_file(const char* filename, HashTable* table) {
+    return execute_input(filename, table, NULL);
 }
 
 int token_equal(BaseToken* eq1, BaseToken* eq2){
-    if(eq1->type != eq2->type) return 0;
+    size_t base = walk.count;
+    push_walk(eq1, eq2, 0);
+    while (walk.count > base){
+        WalkFrame frame = walk.frames[--walk.count];
+        eq1 = frame.token;
+        eq2 = frame.other;
+        if(eq1 == eq2) continue;
+
+        // The hash ignores names so alpha equivalent tokens always have the same one
+        int equal = eq1->hash == eq2->hash && eq1->size == eq2->size && eq1->type == eq2->type &&
+            eq1->loose == eq2->loose && eq1->names == eq2->names;
+
+        // Function names don't matter, bound varriables are compared by index and free ones by name
+        if(equal && eq1->type == 0){
+            if(eq1->index != eq2->index) equal = 0;
+            if(eq1->index == 0 && eq1->symbol != eq2->symbol) equal = 0;
+        }
+        if (!equal){
+            walk.count = base;
+            return 0;
+        }
 
-    if(eq1->type == 0 || eq1->type == 1){
-        int varLen1 = strcspn(eq1->var_name, ":");
-        int varLen2 = strcspn(eq2->var_name, ":");
-    
-        if(varLen1 != varLen2) return 0;
-    
-        char* varName1 = malloc(sizeof(char) * varLen1 + 1);
-        strncpy(varName1, eq1->var_name, varLen1);
-        varName1[varLen1] = '\0';
-    
-        char* varName2 = malloc(sizeof(char) * varLen2 + 1);
-        strncpy(varName2, eq2->var_name, varLen2);
-        varName2[varLen2] = '\0';
-    
-        if(strcmp(varName1, varName2) != 0) return 0;    
+        for (int i = 0; i < eq1->type; i++) push_walk(eq1->in_values[i], eq2->in_values[i], 0);
     }
+    return 1;
+}
 
-    for (int i = 0; i < eq1->type; i++){
-        if (!token_equal(eq1->in_values[i], eq2->in_values[i])) return 0;
+static BaseToken* contract_visit(BaseToken* token, u_int32_t depth, void* data){
+    (void)depth;
+    TableRewrite* rewrite = data;
+    BaseToken* known = pointer_map_get(&rewrite->done, token);
+    if (known) return retain_token(known);
+
+    // Definitions have no loose varriables, only closed parts with the same hash need a full comparison
+    if (token->loose != 0) return NULL;
+    STAT_ADD(table_lookups, 1);
+    for (HashVarriable* entry = rewrite->table->shapes[token->hash % SHAPE_TABLE_SIZE]; entry; entry = entry->next_shape) {
+        STAT_ADD(table_probes, 1);
+        if (token_equal(token, entry->value)) {
+            rewrite->out = 1;
+            return make_var(entry->symbol, 0);
+        }
     }
-    return 1;
+    return NULL;
 }
 
 int contract_varriable(BaseToken** token ,HashTable* table){
-    int count;
-    HashVarriable** allVarriables = get_all_variable_entries(table, &count);
-    if (allVarriables == NULL) return 0;
-
-    for(int i = 0;i < count; i++){
-        if(token_equal((*token), allVarriables[i]->value)){
-            free_token((*token));
-            BaseToken* varToken = malloc(sizeof(BaseToken));
-            memset(varToken, 0, sizeof(BaseToken));
-            varToken->type = 0;
-            varToken->var_name = malloc(strlen(allVarriables[i]->name) + 1);
-            strcpy(varToken->var_name, allVarriables[i]->name);
-            (*token) = varToken;
-            return 1;
+    // Shared parts are only contracted once, their result stays alive through the new token while the map is used
+    TableRewrite rewrite = {table, {0}, 0};
+    BaseToken* result = rewrite_token(*token, 0, contract_visit, remember_table_rewrite, &rewrite);
+    pointer_map_free(&rewrite.done);
+
+    free_token(*token);
+    *token = result;
+    return rewrite.out;
+}
+
+static void count_shared_tokens(BaseToken* token, PointerMap* seen){
+    size_t base = walk.count;
+    push_walk(token, NULL, 0);
+    while (walk.count > base){
+        token = walk.frames[--walk.count].token;
+        if (pointer_map_get(seen, token)) continue;
+        pointer_map_put(seen, token, token);
+        for (int i = 0; i < token->type; i++) push_walk(token->in_values[i], NULL, 0);
+    }
+}
+
+void print_memory_report(BaseToken* token){
+    const char* arenaNames[2] = {"command", "table"};
+    for (int i = 0; i < 2; i++){
+        printf("%s arena: %zu tokens, %zu bytes, peak %zu tokens, %zu shared entries\n", arenaNames[i],
+            token_arenas[i].live, token_arenas[i].live * sizeof(BaseToken), token_arenas[i].peak, unique_tables[i].count);
+    }
+
+    if (token) {
+        // Every distinct token is stored once, the tree size is what a deep copy would need
+        PointerMap seen = {0};
+        count_shared_tokens(token, &seen);
+        printf("term: %zu tokens, %zu bytes, %llu tokens as a tree, sharing ratio %.2f\n", seen.count,
+            seen.count * sizeof(BaseToken), (unsigned long long)token->size, (double)token->size / seen.count);
+        pointer_map_free(&seen);
+    }
+}
+
+/*Runs the reduction of the mode until the budget is spent, 0 when the interaction net can't read its result back*/
+static int run_reduction(BaseToken** term, int mode, Budget* budget, HashTable* table){
+    if (mode == REDUCE_BETA){
+        Reducer reducer;
+        reducer_start(&reducer, *term, NULL);
+        while (!budget_spent(budget)){
+            if (!reducer_step(&reducer)){
+                budget->stop = STOP_NORMAL;
+                break;
+            }
+            budget->taken++;
         }
+        *term = reducer_finish(&reducer);
+        return 1;
+    }
+    if (mode == REDUCE_DELTA){
+        delta_run(term, budget, table);
+        return 1;
+    }
+    if (mode == REDUCE_COMPACT){
+        BaseToken* result = compact_reduce(*term, budget);
+        free_token(*term);
+        *term = result;
+        return 1;
     }
-    int out = 0;
-    for (int i = 0; i < (*token)->type; i++){
-        out = contract_varriable(&(*token)->in_values[i], table) | out;
+
+    // The machines only take a step count and don't tell whether they got to a normal form
+    BaseToken* result;
+    u_int64_t start = stats_clock();
+    if (mode == REDUCE_NEED) result = machine_eval(*term, budget->steps, MACHINE_NEED, NULL);
+    else if (mode == REDUCE_NET) result = net_reduce(*term, budget->steps);
+    else result = par_normalize(*term, budget->steps);
+    if (mode != REDUCE_PAR) stats_phase(PHASE_MACHINE, start);
+    budget->taken = budget->steps;
+    budget->stop = STOP_UNKNOWN;
+    if (!result) return 0;
+    free_token(*term);
+    *term = result;
+    return 1;
+}
+
+static void print_sessions(void){
+    const char* modeNames[] = {"beta", "need", "net", "par", "delta", "compact"};
+    for (Session* session = first_session(); session; session = session->next){
+        printf("%s    %s    %llu steps in %llu runs    stopped at %s    %llu tokens as a tree\n", symbol_name(session->name),
+            modeNames[session->mode], (unsigned long long)session->steps, (unsigned long long)session->runs,
+            stop_name(session->stop), (unsigned long long)session->term->size);
     }
-    return out;
 }
 
 BaseToken* command_interpeter(char* command, HashTable* table){
@@ -485,21 +1847,149 @@ BaseToken* command_interpeter(char* command, HashTable* table){
     if(strcmp(currentCommand, "br") == 0){
         command += 2;
         while(*command == ' ') command++;
+
+        // Call by need runs on the environment machine with shared thunks, --net on an interaction net
+        // --par reduces the arguments of head normal forms at once and --delta computes numerals with builtins
+        // --compact takes the same steps as plain br on index based arrays instead of tokens
+        // --session keeps the partly reduced term for br continue, --time and --mem stop a run early
+        int mode = REDUCE_BETA;
+        Budget budget = {0};
+        u_int64_t time_limit = 0;
+        Symbol session_name = 0;
+        while(strncmp(command, "--", 2) == 0){
+            size_t flagLength = strcspn(command, " ");
+            char* value = command + flagLength;
+            while(*value == ' ') value++;
+            size_t valueLength = strcspn(value, " ");
+
+            if(flagLength == 5 && strncmp(command, "--par", 5) == 0) mode = REDUCE_PAR;
+            else if(flagLength == 6 && strncmp(command, "--need", 6) == 0) mode = REDUCE_NEED;
+            else if(flagLength == 5 && strncmp(command, "--net", 5) == 0) mode = REDUCE_NET;
+            else if(flagLength == 7 && strncmp(command, "--delta", 7) == 0) mode = REDUCE_DELTA;
+            else if(flagLength == 9 && strncmp(command, "--compact", 9) == 0) mode = REDUCE_COMPACT;
+            else if(flagLength == 9 && strncmp(command, "--session", 9) == 0){
+                // Without a name the step count, the next flag or the term follows right away, names are words the parser reads as one name
+                int named = valueLength > 0 && name_length(value) == valueLength && (*value < '0' || *value > '9') && strncmp(value, "--", 2) != 0;
+                if(!named) session_name = intern_symbol(SESSION_DEFAULT, strlen(SESSION_DEFAULT));
+                else {
+                    session_name = intern_symbol(value, valueLength);
+                    flagLength = value + valueLength - command;
+                }
+            }
+            else if((flagLength == 6 && strncmp(command, "--time", 6) == 0) || (flagLength == 5 && strncmp(command, "--mem", 5) == 0)){
+                // The value has to be a number of its own, otherwise the term would lose its first word
+                char* end;
+                u_int64_t limit = strtoull(value, &end, 10);
+                if(*value < '0' || *value > '9' || (*end != ' ' && *end != '\0')){
+                    free(currentCommand);
+                    return make_var(intern_symbol("Invalid Flag Value", strlen("Invalid Flag Value")), 0);
+                }
+                if(flagLength == 6) time_limit = limit;
+                else budget.memory = limit;
+                flagLength = end - command;
+            }
+            else {
+                free(currentCommand);
+                return make_var(intern_symbol("Unknown Flag", strlen("Unknown Flag")), 0);
+            }
+            command += flagLength;
+            while(*command == ' ') command++;
+        }
+
+        size_t wordLength = strcspn(command, " ");
+        if(wordLength == 8 && strncmp(command, "sessions", 8) == 0){
+            free(currentCommand);
+            print_sessions();
+            return make_var(intern_symbol("Reduction Sessions", strlen("Reduction Sessions")), 0);
+        }
+        if(wordLength == 4 && strncmp(command, "drop", 4) == 0){
+            command += 4;
+            while(*command == ' ') command++;
+            free(currentCommand);
+            const char* message = drop_session(intern_symbol(command, strcspn(command, " "))) ? "Session Dropped" : "Unknown Session";
+            return make_var(intern_symbol(message, strlen(message)), 0);
+        }
+
+        // Continuing picks up the term where the last run of the session stopped, with the mode it was started with
+        Session* session = NULL;
+        int resume = wordLength == 8 && strncmp(command, "continue", 8) == 0;
+        if(resume){
+            command += 8;
+            while(*command == ' ') command++;
+            if(*command && (*command < '0' || *command > '9')){
+                size_t nameLength = strcspn(command, " ");
+                session = get_session(intern_symbol(command, nameLength));
+                command += nameLength;
+                while(*command == ' ') command++;
+            }
+            else session = last_session();
+            if(!session){
+                free(currentCommand);
+                return make_var(intern_symbol("Unknown Session", strlen("Unknown Session")), 0);
+            }
+            mode = session->mode;
+        }
+
         char* end;
         int br_count = strtol(command, &end, 10);
         if (command == end) br_count = 100;
+        if (br_count < 0) br_count = 0;
         command = end;
         while(*command == ' ') command++;
+        free(currentCommand);
 
-        BaseToken* token = command_interpeter(command, table);
-        for (int i = 0; i < br_count; i++){
-            int found = beta_reduction_search(&token);
-            if(!found)
-                break;
+        BaseToken* token = resume ? retain_token(session->term) : command_interpeter(command, table);
+        if (session_name) session = open_session(session_name, mode);
+        budget.steps = br_count;
+        if (time_limit) budget.deadline = stats_clock() + time_limit * 1000000;
+
+        // Alpha equivalent terms reduced before under the same mode are answered from the cache
+        // Runs that keep their term or stop on the clock depend on more than the term so they aren't cached
+        int cached = !session && !budget.deadline && !budget.memory;
+        BaseToken* result = cached ? memo_lookup(token, mode, br_count) : NULL;
+        if (result) {
+            free_token(token);
+            return result;
+        }
+
+        // A session of --delta keeps the literals between runs, they only become Church forms for printing
+        BaseToken* term = mode == REDUCE_DELTA && !resume ? delta_native(token, table) : retain_token(token);
+        if (!run_reduction(&term, mode, &budget, table)) {
+            free_token(term);
+            free_token(token);
+            return make_var(intern_symbol("Net Read Back Failed", strlen("Net Read Back Failed")), 0);
+        }
+        if (session) {
+            // A resumed token is the old term of the session, which keeping the new one frees
+            free_token(token);
+            token = NULL;
+            keep_session(session, term, &budget);
         }
+        result = mode == REDUCE_DELTA ? delta_church(term, table) : retain_token(term);
+        free_token(term);
+        if (cached) memo_store(token, result, mode, br_count, budget.taken, budget.stop == STOP_NORMAL, table);
+        free_token(token);
+        return result;
+    }
 
+    if(strcmp(currentCommand, "run") == 0){
+        // Names stay references to the table until the reduction reaches them, so unused definitions are never copied
+        command += 3;
+        while(*command == ' ') command++;
+        char* end;
+        int run_count = strtol(command, &end, 10);
+        if (command == end) run_count = 1000;
+        command = end;
+        while(*command == ' ') command++;
         free(currentCommand);
-        return token;
+
+        Reducer reducer;
+        reducer_start(&reducer, command_interpeter(command, table), table);
+        for (int i = 0; i < run_count; i++){
+            if(!reducer_step(&reducer))
+                break;
+        }
+        return reducer_finish(&reducer);
     }
 
     if(strcmp(currentCommand, "ex") == 0){
@@ -512,10 +2002,12 @@ BaseToken* command_interpeter(char* command, HashTable* table){
         while(*command == ' ') command++;
 
         BaseToken* token = command_interpeter(command, table);
+        u_int64_t start = stats_clock();
         for (int i = 0; i < br_count; i++){
             if(!expand_varriable(&token, table))
                 break;
         }
+        stats_phase(PHASE_EXPAND, start);
 
         return token;
     }
@@ -530,14 +2022,51 @@ BaseToken* command_interpeter(char* command, HashTable* table){
         while(*command == ' ') command++;
 
         BaseToken* token = command_interpeter(command, table);
+        u_int64_t start = stats_clock();
         for (int i = 0; i < br_count; i++){
             if(!contract_varriable(&token, table))
                 break;
         }
+        stats_phase(PHASE_CONTRACT, start);
 
         return token;
     }
 
+    if(strcmp(currentCommand, "eval") == 0){
+        command += 4;
+        while(*command == ' ') command++;
+
+        // Weak head normal form stops at the outermost function, call by need shares argument values
+        int flags = 0;
+        while(strncmp(command, "--", 2) == 0){
+            size_t flagLength = strcspn(command, " ");
+            if(flagLength == 6 && strncmp(command, "--whnf", 6) == 0) flags |= MACHINE_WHNF;
+            else if(flagLength == 6 && strncmp(command, "--need", 6) == 0) flags |= MACHINE_NEED;
+            else {
+                free(currentCommand);
+                return make_var(intern_symbol("Unknown Flag", strlen("Unknown Flag")), 0);
+            }
+            command += flagLength;
+            while(*command == ' ') command++;
+        }
+
+        char* end;
+        long long step_count = strtoll(command, &end, 10);
+        if (command == end) step_count = 1000000;
+        command = end;
+        while(*command == ' ') command++;
+
+        // Defined names are unfolded from the compiled definitions when they are reached, no ex needed
+        BaseToken* token = command_interpeter(command, table);
+        u_int64_t start = stats_clock();
+        BaseToken* result = machine_eval(token, step_count, flags, table);
+        stats_phase(PHASE_MACHINE, start);
+        free_token(token);
+
+        free(currentCommand);
+        return result;
+    }
+
     if(strcmp(currentCommand, "load") == 0){
         command += 4;
         while(*command == ' ') command++;
@@ -549,7 +2078,25 @@ BaseToken* command_interpeter(char* command, HashTable* table){
         varName[varNameLength] = '\0';
         command += varNameLength;
 
-        execute_file(varName, table);
+        int loaded = execute_file(varName, table);
+        free(varName);
+        if (loaded < 0) {
+            free(currentCommand);
+            return make_var(intern_symbol("Failed Loading File", strlen("Failed Loading File")), 0);
+        }
+    }
+
+    if(strcmp(currentCommand, "save") == 0 || strcmp(currentCommand, "restore") == 0){
+        int save = currentCommand[0] == 's';
+        command += currentCommandLength;
+        while(*command == ' ') command++;
+        free(currentCommand);
+
+        // The whole table goes to or comes from one binary image, nothing is parsed
+        const char* message;
+        if (save) message = save_snapshot(table, command) < 0 ? "Failed Saving Snapshot" : "Saved Snapshot";
+        else message = restore_snapshot(table, command) < 0 ? "Failed Restoring Snapshot" : "Restored Snapshot";
+        return make_var(intern_symbol(message, strlen(message)), 0);
     }
 
     if(strcmp(currentCommand, "def") == 0){
@@ -558,83 +2105,263 @@ BaseToken* command_interpeter(char* command, HashTable* table){
 
         size_t varNameLength = strcspn(command, " =");
 
-        char* varName = malloc(sizeof(char) * varNameLength + 1);
-        strncpy(varName, command, varNameLength);
-        varName[varNameLength] = '\0';
+        Symbol varName = intern_symbol(command, varNameLength);
         command += varNameLength;
         while(*command == ' ') command++;
 
+        // A value that couldn't be read leaves the definition as it was
+        size_t errors = syntax_errors;
         BaseToken* token = command_interpeter(command, table);
+        if (syntax_errors != errors) return token;
         insert_variable(table, varName, token);
 
-        BaseToken* errorToken = malloc(sizeof(BaseToken));
-        memset(errorToken, 0, sizeof(BaseToken)); 
-        errorToken->var_name = strdup("Created Varriable");
-        errorToken->type = 0;
-        errorToken->var_len = strlen(errorToken->var_name);
+        BaseToken* errorToken = make_var(intern_symbol("Created Varriable", strlen("Created Varriable")), 0);
         return errorToken;
     }
 
+    if(strcmp(currentCommand, "prim") == 0){
+        command += 4;
+        while(*command == ' ') command++;
+        free(currentCommand);
+
+        // Without a name the bound definitions are listed
+        if(*command == '\0'){
+            for (size_t i = 0; i < table->count; i++){
+                if (table->entries[i]->prim) printf("%s    %s\n", symbol_name(table->entries[i]->symbol), prim_name(table->entries[i]->prim));
+            }
+            return make_var(intern_symbol("Primitives", strlen("Primitives")), 0);
+        }
+
+        size_t varNameLength = strcspn(command, " ");
+        HashVarriable* entry = get_variable_entry(table, intern_symbol(command, varNameLength));
+        command += varNameLength;
+        while(*command == ' ') command++;
+
+        // A definition is only bound when it computes the same results as the builtin, so argument order mistakes are caught
+        const char* message;
+        int op = prim_op(command);
+        if (!entry) message = "Undefined Varriable";
+        else if (strcmp(command, "none") == 0) {
+            entry->prim = 0;
+            memo_invalidate(entry->symbol);
+            message = "Unbound Primitive";
+        }
+        else if (!op) message = "Unknown Primitive";
+        else if (!check_primitive(entry->value, op, table)) message = "Primitive Does Not Match";
+        else {
+            entry->prim = op;
+            memo_invalidate(entry->symbol);
+            message = "Bound Primitive";
+        }
+        return make_var(intern_symbol(message, strlen(message)), 0);
+    }
+
+    if(strcmp(currentCommand, "memo") == 0){
+        command += 4;
+        while(*command == ' ') command++;
+        free(currentCommand);
+
+        if(strcmp(command, "clear") == 0){
+            memo_clear();
+            return make_var(intern_symbol("Cache Cleared", strlen("Cache Cleared")), 0);
+        }
+        if(strncmp(command, "budget", 6) == 0){
+            memo_set_budget(strtoull(command + 6, NULL, 10));
+            return make_var(intern_symbol("Cache Budget Set", strlen("Cache Budget Set")), 0);
+        }
+        MemoReport report;
+        memo_report(&report);
+        printf("%-16s %zu\n%-16s %zu\n%-16s %zu\n", "entries", report.entries, "bytes", report.bytes, "budget", report.budget);
+        printf("%-16s %llu\n%-16s %llu\n%-16s %llu\n%-16s %llu\n", "hits", (unsigned long long)report.hits,
+            "misses", (unsigned long long)report.misses, "evictions", (unsigned long long)report.evictions,
+            "invalidations", (unsigned long long)report.invalidations);
+        return make_var(intern_symbol("Normal Form Cache", strlen("Normal Form Cache")), 0);
+    }
+
     if(strcmp(currentCommand, "show") == 0){
         print_map_varriables(table);
 
-        BaseToken* errorToken = malloc(sizeof(BaseToken));
-        memset(errorToken, 0, sizeof(BaseToken)); 
-        errorToken->var_name = strdup("Varriable Table");
-        errorToken->type = 0;
-        errorToken->var_len = strlen(errorToken->var_name);
+        BaseToken* errorToken = make_var(intern_symbol("Varriable Table", strlen("Varriable Table")), 0);
         return errorToken;
     }
 
+    if(strcmp(currentCommand, "mem") == 0){
+        command += 3;
+        while(*command == ' ') command++;
+
+        // Without a term only the arenas are reported
+        BaseToken* token = *command ? command_interpeter(command, table) : NULL;
+        print_memory_report(token);
+
+        free(currentCommand);
+        if (token) return token;
+        return make_var(intern_symbol("Memory Report", strlen("Memory Report")), 0);
+    }
+
+    if(strcmp(currentCommand, "stats") == 0){
+        command += 5;
+        while(*command == ' ') command++;
+        free(currentCommand);
+
+        // Totals of the finished commands, the running one is added when it ends
+        if(strcmp(command, "reset") == 0){
+            stats_reset();
+            return make_var(intern_symbol("Statistics Cleared", strlen("Statistics Cleared")), 0);
+        }
+        Stats totals;
+        stats_totals(&totals);
+        print_stats(stdout, &totals, 0);
+        return make_var(intern_symbol("Statistics", strlen("Statistics")), 0);
+    }
+
     free(currentCommand);
 
     
-    BaseToken* rootToken = malloc(sizeof(BaseToken));
-    memset(rootToken, 0, sizeof(BaseToken)); 
+    BaseToken* rootToken;
     char *input_cpy = command;
+    u_int64_t start = stats_clock();
     parse_str(&input_cpy, &rootToken);
+    stats_phase(PHASE_PARSE, start);
     return rootToken;
 }
 
+/*Fills the table from the snapshot while it is newer than the load file, otherwise runs the file and saves the snapshot
+Returns -1 when nothing given could be read*/
+static int load_startup(arguments args, HashTable* table){
+    if (args.snapshot) {
+        struct stat snapshot_info, file_info;
+        int fresh = stat(args.snapshot, &snapshot_info) == 0;
+        if (fresh && args.load_file) {
+            fresh = stat(args.load_file, &file_info) == 0 && (snapshot_info.st_mtim.tv_sec > file_info.st_mtim.tv_sec ||
+                (snapshot_info.st_mtim.tv_sec == file_info.st_mtim.tv_sec && snapshot_info.st_mtim.tv_nsec >= file_info.st_mtim.tv_nsec));
+        }
+        if (fresh && restore_snapshot(table, args.snapshot) >= 0) return 0;
+    }
+    if (!args.load_file) return args.snapshot ? -1 : 0;
+    if (execute_file(args.load_file, table) < 0) return -1;
+    if (args.snapshot && save_snapshot(table, args.snapshot) < 0)
+        fprintf(stderr, "Failed to save snapshot %s\n", args.snapshot);
+    return 0;
+}
+
 int input_loop(arguments args){
     char *input = NULL;
-    srand(time(NULL));
-    HashTable table;
-    memset(&table, 0, sizeof(HashTable));
-
-    if(args.load_file){
-        BaseToken* token = command_interpeter(add_prefix("load ", args.load_file), &table);
-        if(token != NULL){
-            free_token(token);
-        }
+    HashTable* table = calloc(1, sizeof(HashTable));
+    if (!table) {
+        perror("Failed to allocate memory for table");
+        exit(EXIT_FAILURE);
     }
 
+    verbose_stats = args.verbose;
+    print_options = args.print;
+    stats_timing = args.verbose;
+    memo_set_budget(args.memo_budget);
+    load_startup(args, table);
+    stats_end_command();
+    end_command();
+
 
     while (1)
     {
         input = readline(" > ");
-        if (strcmp(input, "exit\n") == 0) {
+        if (!input || strcmp(input, "exit") == 0) {
             printf("Exiting program...\n");
             break;
         }
-        BaseToken* token = command_interpeter(input, &table);
-        if(token != NULL){
-            print_parse(token);
-            free_token(token);
-            printf("\n");
+        // A term with open parenthasis goes on on the next lines
+        long open = open_parenthasis(input, strlen(input));
+        while (open > 0) {
+            char* more = readline(" . ");
+            if (!more) break;
+            open += open_parenthasis(more, strlen(more));
+            char* joined = malloc(strlen(input) + strlen(more) + 2);
+            if (!joined) {
+                perror("Failed to allocate memory for input");
+                exit(EXIT_FAILURE);
+            }
+            sprintf(joined, "%s\n%s", input, more);
+            free(input);
+            free(more);
+            input = joined;
         }
+        BaseToken* token = command_interpeter(input, table);
+        print_result(stdout, token);
+        // Everything the command allocated is released at once
+        end_command();
  
 
         add_history(input);
         free(input);
     }
+    free(input);
+    free_par();
+    memo_clear();
+    free_sessions();
+    free_table(table);
+    free_arenas();
     return 1;
 }
 
-int main(int argc, char* argv[]){
-    arguments args = {0};
+int batch_loop(arguments args){
+    HashTable* table = calloc(1, sizeof(HashTable));
+    if (!table) {
+        perror("Failed to allocate memory for table");
+        exit(EXIT_FAILURE);
+    }
 
-    argp_parse(&argp, argc, argv, 0, 0, &args);
+    // Results are only written out when the buffer fills, a terminal would flush every line
+    static char output[1 << 20];
+    setvbuf(stdout, output, _IOFBF, sizeof(output));
+
+    verbose_stats = args.verbose;
+    print_options = args.print;
+    stats_timing = args.verbose;
+    memo_set_budget(args.memo_budget);
+    if(load_startup(args, table) < 0) return EXIT_FAILURE;
+    stats_end_command();
+
+    // The calling thread is one of the workers
+    int threads = args.jobs > 0 ? args.jobs : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    WorkerPool* pool = threads > 1 ? pool_create(threads - 1, free_thread_arenas) : NULL;
+
+    char* standard_input = "-";
+    char** files = args.file_count ? args.files : &standard_input;
+    int file_count = args.file_count ? args.file_count : 1;
+    int status = EXIT_SUCCESS;
+
+    for (int i = 0; i < file_count; i++){
+        BatchRun run = {0};
+        run.pool = pool;
+        run.table = table;
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        int go_on = execute_input(files[i], table, &run);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        free(run.lines);
+        free(run.outputs);
+        free(run.output_sizes);
+
+        // Timings go to stderr after the results of the file so they never mix with the results
+        fflush(stdout);
+        if (go_on < 0) {
+            status = EXIT_FAILURE;
+            continue;
+        }
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        if (seconds <= 0) seconds = 1e-9;
+        fprintf(stderr, "%s: %zu commands, %zu bytes in %.3f s (%.0f commands/s, %.2f MB/s)\n",
+            files[i], run.commands, run.bytes, seconds, run.commands / seconds, run.bytes / seconds / 1e6);
+        if (!go_on) break;
+    }
 
-    return input_loop(args);
+    fflush(stdout);
+    setvbuf(stdout, NULL, _IONBF, 0);
+    pool_free(pool);
+    free_par();
+    memo_clear();
+    free_sessions();
+    free_table(table);
+    free_arenas();
+    free(args.files);
+    return status;
 }
@@ -1,109 +1,290 @@
 #ifndef LAMBDA_CALC
 #define LAMBDA_CALC
 
+#include <stdio.h>
 #include <sys/types.h>
 #include <argp.h>
 
-/*Hash map table size(should be based round the expected number of varriables)*/
+/*Starting number of slots of the definition index, it doubles whenever it is half full*/
 #define TABLE_SIZE 128
-/*Values for argp*/
-const char *argp_program_version = "lambdacalc 0.1";
-const char *argp_program_bug_address = "<axowattle@gmail.com>";
-static char doc[] = "Lambda Calculus Calculator for linux using C";
+/*Buckets of the index of definitions by the hash of their value*/
+#define SHAPE_TABLE_SIZE 1024
 
-static struct argp argp = {options, parse_opt, 0, doc};
+/*Interned name, every distinct name has one small number starting at 1, 0 is no name*/
+typedef u_int32_t Symbol;
 
+/*Bit of a free name in the names of a token, names sharing a bit only make a check look further*/
+#define NAME_BIT(symbol) ((u_int64_t)1 << ((symbol) % 64))
 
-/*Basic token of the Lambda*/
+/*Basic token of the Lambda, tokens are shared and never changed after they are made*/
 typedef struct BaseToken{
     u_int8_t type; // Type 0: varriable, 1: function defention, 2: function execution
-    char* var_name; // Name of the stored varriable in the token(used in types 0, 1)
-    size_t var_len; // Lenght of the character although most places use strlen 
+    u_int8_t arena; // Arena the token was allocated from
+    u_int32_t refs; // Number of references from tokens and owners in the same arena
+    Symbol symbol; // Name of the varriable(used in types 0, 1), only needed for printing and free names
+    u_int32_t index; // De Bruijn index of type 0 tokens: 0 for free names, n for the n-th enclosing function
+    u_int32_t hash; // Structural hash, equal for alpha equivalent tokens
+    u_int32_t loose; // Highest index pointing outside of the token, 0 when no bound varriable escapes it
+    u_int64_t names; // NAME_BIT of every free name inside, with loose 0 as well the token is closed
+    u_int64_t size; // Number of tokens when expanded to a tree, saturates at UINT64_MAX
     struct BaseToken* in_values[2]; // Child values of the token used 1 in type 1 and 2 in type 2
+    struct BaseToken* next_shared; // Next token in the same unique table bucket
 } BaseToken;
 
+/*Starting size of the hash consing tables*/
+#define UNIQUE_TABLE_SIZE 4096
+
+/*Hash consing table so every distinct token exists once per arena*/
+typedef struct UniqueTable {
+    BaseToken** buckets;
+    size_t capacity;
+    size_t count;
+} UniqueTable;
+
+/*Open addressing map between pointers*/
+typedef struct PointerMap {
+    void** keys;
+    void** values;
+    size_t capacity;
+    size_t count;
+} PointerMap;
+
+/*Names of the symbols are kept in chunks that never move, so a name can be read while another thread adds one*/
+#define SYMBOL_CHUNK_SIZE 4096
+#define SYMBOL_CHUNKS 16384
+
+/*Interned names, open addressing index from the text of a name to its symbol*/
+typedef struct NameTable {
+    Symbol* slots; // 0 for an empty slot
+    size_t capacity;
+    Symbol count; // Symbols handed out, the next one is count + 1
+} NameTable;
+
 /*Hash varriable to store saved varriable names*/
 typedef struct HashVarriable
 {
-    char* name;
+    Symbol symbol; // Name of the varriable
     BaseToken* value;
-    struct HashVarriable* next;
+    struct Code* code; // Compiled value, NULL until it is first evaluated
+    u_int8_t prim; // Builtin operation br --delta reduces the definition with, 0 for none
+    struct HashVarriable* next_shape; // Next definition in the same bucket of the shape index
 } HashVarriable;
 
 /*Hash table for varriables*/
 typedef struct HashTable {
-    HashVarriable* table[TABLE_SIZE];
+    HashVarriable** entries; // Definitions in the order they were first made
+    size_t count;
+    size_t capacity;
+    u_int32_t* slots; // Open addressing index by symbol, position in entries plus one, 0 when empty
+    size_t slot_capacity;
+    HashVarriable* shapes[SHAPE_TABLE_SIZE]; // Definitions by the alpha invariant hash of their value
+    u_int64_t names; // NAME_BIT of every name that was ever defined
 } HashTable;
 
-/*Options for argp*/
-// note: verbose currentl does nothing
-static struct argp_option options[] = {
-    {"verbose", 'v', 0, 0, "Produce verbose output"},
-    {"loadfile",  'f', "FILE", 0, "Load File in the start"},
-    {0}
-};
+/*Closed parts at least this large are bound once when they are reached from more than one parent*/
+#define PRINT_SHARE_SIZE 5
+
+/*How results are printed*/
+typedef struct PrintOptions{
+    size_t max_length; // Characters after which the rest of the term is printed as ..., 0 for no limit
+    u_int32_t max_depth; // Nesting below which parts are printed as ..., 0 for no limit
+    int share; // Print every shared closed part once, as the value of a function around the term
+} PrintOptions;
 
 /*Given arguments for the current execution*/
 typedef struct arguments {
     int verbose;
     char *load_file;
+    char *snapshot; // Table image used instead of load_file while it is newer, rewritten when it isn't
+    int batch; // Run files without the prompt
+    int jobs; // Threads of a batch run, 0 for one per core
+    size_t memo_budget; // Bytes the cache of normal forms may use, 0 turns it off
+    PrintOptions print; // Limits and sharing of printed results
+    char **files; // Files given after the options
+    int file_count;
 }arguments;
 
-/*Parse the given arguments into the struct*/
-static error_t parse_opt(int key, char *arg, struct argp_state *state);
+/*Number of query lines a batch collects before it has to run them*/
+#define BATCH_QUEUE_SIZE 4096
+
+/*State of a batch run through one input*/
+typedef struct BatchRun {
+    size_t commands;
+    size_t bytes;
+    struct WorkerPool* pool; // Runs the queries between two other lines at once, NULL runs every line in order
+    HashTable* table;
+    char** lines; // Queries waiting for the next line that isn't one
+    char** outputs; // Printed results of the waiting queries
+    size_t* output_sizes;
+    size_t pending;
+    size_t capacity;
+} BatchRun;
 
 /*Adds two strings together one as a prefix and one as a string*/
 char* add_prefix(const char* prefix, const char* str);
 
-#define CHARSET "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"
+/*Returns the symbol of the given name, creating it on first use*/
+Symbol intern_symbol(const char* str, size_t len);
 
-/*Function to generate a random string of given size*/
-char* generate_random_string(char spacer,size_t length);
+/*Text of the symbol*/
+const char* symbol_name(Symbol symbol);
 
-/*Free the token pointer and all its children*/
-void free_token(BaseToken* token);
+/*Free all interned names*/
+void free_names(void);
+
+/*Arena of tokens that only live until the end of the current command*/
+#define COMMAND_ARENA 0
+/*Arena of tokens stored in the varriable table*/
+#define TABLE_ARENA 1
+
+/*First arena of the reduction workers, each worker thread makes its tokens in an arena of its own*/
+#define WORKER_ARENA 2
+
+/*Release all tokens of the current command at once*/
+void end_command(void);
+
+/*Number of tokens the calling thread made since it started*/
+size_t tokens_allocated(void);
+
+/*Makes new tokens of the calling thread in the given arena, its tokens are borrowed by every other thread*/
+void use_worker_arena(u_int8_t arena);
+
+/*Makes new tokens in the given arena without changing the command arena, returns the arena used before*/
+u_int8_t set_active_arena(u_int8_t arena);
+
+/*Value stored for the key, NULL when it has none*/
+void* pointer_map_get(PointerMap* map, void* key);
 
-/*Hash function for the hasmap*/
-unsigned int hash(const char* str);
+/*Stores the value for the key, replacing an older one*/
+void pointer_map_put(PointerMap* map, void* key, void* value);
+
+/*Frees the arrays of the map*/
+void pointer_map_free(PointerMap* map);
+
+/*Free the token arenas of the calling thread*/
+void free_thread_arenas(void);
+
+/*Free the token arenas and interned names*/
+void free_arenas(void);
+
+/*Returns the varriable token, index 0 is a free name*/
+BaseToken* make_var(Symbol symbol, u_int32_t index);
+
+/*Returns the function token, takes over the reference to the body*/
+BaseToken* make_function(Symbol symbol, BaseToken* body);
+
+/*Returns the execution token, takes over the references to both children*/
+BaseToken* make_application(BaseToken* func, BaseToken* value);
+
+/*Adds a reference to the token*/
+BaseToken* retain_token(BaseToken* token);
+
+/*Drops a reference to the token, it and its children are freed when nothing uses them*/
+void free_token(BaseToken* token);
 
 /*Function to get all HashVarriables in the table*/
 HashVarriable** get_all_variable_entries(HashTable* ht, int* count);
 
-/*Insert varriable into hashmap*/
-void insert_variable(HashTable* ht, const char* name, BaseToken* value);
+/*Insert varriable into hashmap, the value is copied to the table arena*/
+void insert_variable(HashTable* ht, Symbol symbol, BaseToken* value);
 
 /*Retrive a varriable from the hash table by name*/
-BaseToken* get_variable(HashTable* ht, const char* name);
+BaseToken* get_variable(HashTable* ht, Symbol symbol);
 
-/*Copy all data of token and all its children to a new pointer*/
+/*Retrive the entry of a varriable from the hash table by name, NULL if it isn't defined*/
+HashVarriable* get_variable_entry(HashTable* ht, Symbol symbol);
+
+/*Returns another reference to the token, tokens are shared instead of copied*/
 BaseToken* clone_base_token(BaseToken* token);
 
+/*Returns the token made of tokens of the arena, parts from other arenas are copied*/
+BaseToken* clone_into(BaseToken* token, u_int8_t arena);
+
+/*Result for a token without visiting its children, or NULL to rebuild the token from its rewritten children*/
+typedef BaseToken* (*RewriteVisit)(BaseToken* token, u_int32_t depth, void* data);
+
+/*Called with every token rebuilt from its children*/
+typedef void (*RewriteBuilt)(BaseToken* token, BaseToken* result, void* data);
+
+/*Rebuilds the token bottom up, tokens whose children didn't change are kept*/
+BaseToken* rewrite_token(BaseToken* token, u_int32_t depth, RewriteVisit visit, RewriteBuilt built, void* data);
+
+/*Reductions br can run a term with, the mode of a cached result or a session*/
+#define REDUCE_BETA 0
+#define REDUCE_NEED 1 // Call by need on the environment machine
+#define REDUCE_NET 2 // Interaction net
+#define REDUCE_PAR 3 // Arguments of head normal forms at once on the worker pool
+#define REDUCE_DELTA 4 // Numerals and booleans as machine integers
+#define REDUCE_COMPACT 5 // Normal order on the index based store of compact.h
+
+/*Why a reduction stopped*/
+#define STOP_NORMAL 0 // Normal form reached
+#define STOP_STEPS 1
+#define STOP_TIME 2
+#define STOP_MEMORY 3
+#define STOP_UNKNOWN 4 // The machines don't tell whether they reached a normal form
+
+/*Clock and memory are looked at once every this many steps*/
+#define BUDGET_CHECK_STEPS 256
+
+/*Limits of one reduction run*/
+typedef struct Budget {
+    u_int64_t steps; // Most reductions
+    u_int64_t deadline; // Monotonic time in nanoseconds to stop at, 0 for none
+    size_t memory; // Most bytes of live tokens of the calling thread, 0 for none
+    u_int64_t taken; // Reductions done so far
+    int stop; // Why the run stopped
+} Budget;
+
+/*1 when another step would go over the budget, the reason is stored in it*/
+int budget_spent(Budget* budget);
+
+/*Number of tokens of the calling thread in use right now*/
+size_t tokens_live(void);
+
+/*Reduces the redex, the token has to be the application of a function*/
+void beta_reduction(BaseToken** token);
+
+/*Reduces the leftmost outermost redex, 0 when there is none*/
+int beta_reduction_search(BaseToken** token);
+
+
+/*Ancestor of the token a Reducer is at, with the children it has so far*/
+typedef struct ReduceFrame {
+    BaseToken* token; // Token the frame was entered with, rebuilt from the children when the search leaves it
+    BaseToken* in_values[2]; // Children, the one being searched is taken out
+    u_int8_t state; // Child being searched
+} ReduceFrame;
+
+/*Normal order reduction that keeps its place in the term between steps
+Everything left of the focus is in normal form, so the next redex is the focus itself, inside it or right of it*/
+typedef struct Reducer {
+    ReduceFrame* frames; // Path from the root down to the focus
+    size_t count;
+    size_t capacity;
+    BaseToken* focus; // Token being searched
+    HashTable* table; // Free names defined in it unfold when they are reached, NULL for plain beta reduction
+    int normal; // The focus was searched and has no redex
+    int contracted; // The focus is the result of the last step
+} Reducer;
+
+/*Starts a reduction of the token, the reference is taken over*/
+void reducer_start(Reducer* reducer, BaseToken* token, HashTable* table);
+
+/*Takes the next step, 0 when the term is in normal form*/
+int reducer_step(Reducer* reducer);
+
+/*Returns the term with every step taken so far and frees the path*/
+BaseToken* reducer_finish(Reducer* reducer);
+
 /*Free hasmap data*/
 void free_table(HashTable* ht);
 
 /*A parser to parse string input to a tree describing the lambda functions*/
 void parse_str(char** input, BaseToken** token);
 
-/*A parser to parse string input to a tree describing the lambda functions*/
-void parse_str(char** input, BaseToken** token);
-
-/*Adds suffix to all the tokens that has varriable and their children*/
-int add_recursive_suffix(BaseToken* token, char* suffix);
-
-/*Adds suffix to all the tokens that has varriable and their children*/
-int add_recursive_suffix(BaseToken* token, char* suffix);
-
-/*Adds suffix to all the tokens that has varriable and their children*/
-int add_recursive_suffix(BaseToken* token, char* suffix);
-
-/*Adds suffix to all the tokens that has varriable and their children*/
-int add_recursive_suffix(BaseToken* token, char* suffix);
-
-/*Adds suffix to all the tokens that has varriable and their children*/
-int add_recursive_suffix(BaseToken* token, char* suffix);
-
-/*Convert varriable names to their full value*/
-int expand_varriable(BaseToken** token, HashTable* table);
+/*Returns the token with d added to every varriable index that points above the cutoff*/
+BaseToken* shift_indices(BaseToken* token, int d, u_int32_t cutoff);
 
 /*Convert varriable names to their full value*/
 int expand_varriable(BaseToken** token, HashTable* table);
@@ -111,19 +292,38 @@ int expand_varriable(BaseToken** token, HashTable* table);
 /*Removes \n and the end of lines*/
 void remove_newline(char* str);
 
-/*Executes the commands in a file sperated by \n*/
-void execute_file(const char* filename, HashTable* table);
+/*Executes the commands in a file sperated by \n, "-" is stdin, printing every result when run is given
+Returns -1 when the file can't be read, 0 when a line asked to exit and 1 otherwise*/
+int execute_input(const char* filename, HashTable* table, BatchRun* run);
+
+/*Executes the commands in a file sperated by \n without printing, -1 when the file can't be read*/
+int execute_file(const char* filename, HashTable* table);
 
 /*Checks the equality of two tokens*/
 int token_equal(BaseToken* eq1, BaseToken* eq2);
 
-/*Converts a varriable values to varriable name*/
+/*Converts every part of the token equal to a definition to the definition name in one pass*/
 int contract_varriable(BaseToken** token ,HashTable* table);
 
+/*Prints the token to stdout with readable names*/
+void print_parse(BaseToken* token);
+
+/*Prints the token to the stream with readable names*/
+void fprint_parse(FILE* out, BaseToken* token);
+
+/*Prints the token to the stream within the limits of the options, in one write*/
+void fprint_limited(FILE* out, BaseToken* token, PrintOptions* options);
+
+/*Prints the arena usage and how much of the token is shared*/
+void print_memory_report(BaseToken* token);
+
 /*Handles inputs of command and execution of correct functions*/
 BaseToken* command_interpeter(char* command, HashTable* table);
 
 /*Input loop to get commands from the user*/
 int input_loop(arguments args);
 
+/*Runs the input files one after another without the prompt, reporting the time of each to stderr*/
+int batch_loop(arguments args);
+
 #endif
\ No newline at end of file
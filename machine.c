@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "machine.h"
+
+static void* grow_array(void* array, size_t* capacity, size_t size, size_t initial) {
+    *capacity = *capacity ? *capacity * 2 : initial;
+    array = realloc(array, *capacity * size);
+    if (!array) {
+        perror("Failed to allocate memory for machine");
+        exit(EXIT_FAILURE);
+    }
+    return array;
+}
+
+static Thunk* new_thunk(Machine* machine, const Instr* term, Env* env) {
+    Thunk* thunk = arena_alloc(&machine->thunks);
+    memset(thunk, 0, sizeof(Thunk));
+    thunk->term = term;
+    thunk->env = env;
+    return thunk;
+}
+
+static Thunk* new_var_thunk(Machine* machine, Symbol name, u_int32_t level) {
+    Thunk* thunk = new_thunk(machine, NULL, NULL);
+    thunk->name = name;
+    thunk->level = level;
+    return thunk;
+}
+
+static Env* extend_env(Machine* machine, Thunk* value, Env* next) {
+    Env* env = arena_alloc(&machine->envs);
+    env->value = value;
+    env->next = next;
+    return env;
+}
+
+static Thunk* lookup(Env* env, u_int32_t index) {
+    while (--index > 0) env = env->next;
+    return env->value;
+}
+
+static void push_arg(Machine* machine, Thunk* arg) {
+    if (machine->depth == machine->capacity)
+        machine->stack = grow_array(machine->stack, &machine->capacity, sizeof(Thunk*), 256);
+    machine->stack[machine->depth++] = arg;
+}
+
+static BaseToken* own_token(Machine* machine, BaseToken* token) {
+    if (machine->owned_count == machine->owned_capacity)
+        machine->owned = grow_array(machine->owned, &machine->owned_capacity, sizeof(BaseToken*), 64);
+    machine->owned[machine->owned_count++] = token;
+    return token;
+}
+
+static Code* own_code(Machine* machine, Code* code) {
+    if (machine->code_count == machine->code_capacity)
+        machine->codes = grow_array(machine->codes, &machine->code_capacity, sizeof(Code*), 64);
+    machine->codes[machine->code_count++] = code;
+    return code;
+}
+
+static void update_thunk(Thunk* thunk, const Instr* term, Env* env) {
+    thunk->term = term;
+    thunk->env = env;
+    thunk->evaluated = 1;
+}
+
+/*Overwrites the thunk with its stuck value, the head applied to the arguments pushed since its evaluation started*/
+static void update_stuck(Machine* machine, Update* update, const Instr* head, Env* env) {
+    size_t count = machine->depth - update->depth;
+
+    // The value gets an environment of its own: index count + 1 is the head and index 1 the last argument
+    Env* valueEnv = NULL;
+    BaseToken* term;
+    if (head->op == OP_NAME) {
+        term = make_var(head->name, 0);
+    } else {
+        valueEnv = extend_env(machine, lookup(env, head->arg), NULL);
+        term = make_var(head->name, count + 1);
+    }
+    for (size_t i = machine->depth; i > update->depth; i--) {
+        valueEnv = extend_env(machine, machine->stack[i - 1], valueEnv);
+        term = make_application(term, make_var(head->name, i - update->depth));
+    }
+    update_thunk(update->thunk, own_code(machine, compile_code(term, NULL))->instrs, valueEnv);
+    free_token(term);
+}
+
+/*Runs the machine until the token is a function without arguments above base or a stuck varriable*/
+static void machine_whnf(Machine* machine, const Instr** term, Env** env, size_t base) {
+    size_t updateBase = machine->update_depth;
+
+    while (machine->steps < machine->limit) {
+        const Instr* token = *term;
+
+        if (token->op == OP_APP) {
+            // Varriable arguments pass on the existing thunk instead of wrapping it
+            const Instr* value = SHARED_TARGET(token + token->arg);
+            if (value->op == OP_VAR) push_arg(machine, lookup(*env, value->arg));
+            else push_arg(machine, new_thunk(machine, value, *env));
+            *term = SHARED_TARGET(token + 1);
+            continue;
+        }
+
+        if (token->op == OP_LAM) {
+            // A function with none of its own arguments is the value of the thunk being evaluated
+            if (machine->update_depth > updateBase && machine->updates[machine->update_depth - 1].depth == machine->depth) {
+                update_thunk(machine->updates[--machine->update_depth].thunk, token, *env);
+                continue;
+            }
+            if (machine->depth == base) return;
+            *env = extend_env(machine, machine->stack[--machine->depth], *env);
+            *term = SHARED_TARGET(token + 1);
+            machine->steps++;
+            continue;
+        }
+
+        // Defined names run the code of their definition, names defined after the code was compiled are looked up
+        HashVarriable* entry = NULL;
+        if (token->op == OP_GLOBAL) entry = token->entry;
+        else if (token->op == OP_NAME && machine->table) entry = get_variable_entry(machine->table, token->name);
+        if (entry) {
+            *term = definition_code(entry, machine->table)->instrs;
+            *env = NULL;
+            machine->steps++;
+            continue;
+        }
+
+        // Free names and varriables of functions being read back can't go further
+        Thunk* thunk = token->op == OP_NAME ? NULL : lookup(*env, token->arg);
+        if (!thunk || !thunk->term) {
+            while (machine->update_depth > updateBase)
+                update_stuck(machine, &machine->updates[--machine->update_depth], token, *env);
+            return;
+        }
+
+        if ((machine->flags & MACHINE_NEED) && !thunk->evaluated) {
+            if (machine->update_depth == machine->update_capacity)
+                machine->updates = grow_array(machine->updates, &machine->update_capacity, sizeof(Update), 64);
+            machine->updates[machine->update_depth].thunk = thunk;
+            machine->updates[machine->update_depth].depth = machine->depth;
+            machine->update_depth++;
+        }
+        *term = thunk->term;
+        *env = thunk->env;
+    }
+
+    // Out of steps, the thunks that were being evaluated keep their unevaluated closure
+    machine->update_depth = updateBase;
+}
+
+static void push_task(Machine* machine, u_int8_t kind, const Instr* term, Env* env, u_int32_t level) {
+    if (machine->task_count == machine->task_capacity)
+        machine->tasks = grow_array(machine->tasks, &machine->task_capacity, sizeof(Task), 256);
+    Task* task = &machine->tasks[machine->task_count++];
+    memset(task, 0, sizeof(Task));
+    task->kind = kind;
+    task->term = term;
+    task->env = env;
+    task->level = level;
+}
+
+static void push_result(Machine* machine, BaseToken* token) {
+    if (machine->result_count == machine->result_capacity)
+        machine->results = grow_array(machine->results, &machine->result_capacity, sizeof(BaseToken*), 256);
+    machine->results[machine->result_count++] = token;
+}
+
+/*Builds the token of a closure by replacing the varriables with their values*/
+static void quote(Machine* machine, const Instr* term, Env* env, u_int32_t level) {
+    while (term->op == OP_VAR) {
+        Thunk* thunk = lookup(env, term->arg);
+        if (!thunk->term) {
+            push_result(machine, make_var(thunk->name, level - thunk->level));
+            return;
+        }
+        term = thunk->term;
+        env = thunk->env;
+    }
+
+    if (term->op == OP_NAME || term->op == OP_GLOBAL) {
+        push_result(machine, make_var(instr_name(term), 0));
+    } else if (term->op == OP_LAM) {
+        Thunk* var = new_var_thunk(machine, term->name, level);
+        push_task(machine, TASK_FUNCTION, term, NULL, level);
+        push_task(machine, TASK_QUOTE, SHARED_TARGET(term + 1), extend_env(machine, var, env), level + 1);
+    } else {
+        // The function is quoted first so it ends up below the argument
+        push_task(machine, TASK_APPLY, NULL, NULL, level);
+        push_task(machine, TASK_QUOTE, SHARED_TARGET(term + term->arg), env, level);
+        push_task(machine, TASK_QUOTE, SHARED_TARGET(term + 1), env, level);
+    }
+}
+
+static void read_back_arg(Machine* machine, Thunk* arg, u_int32_t level) {
+    if (!arg->term) {
+        push_result(machine, make_var(arg->name, level - arg->level));
+    } else if (machine->flags & MACHINE_WHNF) {
+        push_task(machine, TASK_QUOTE, arg->term, arg->env, level);
+    } else if (arg->normal && arg->normal_level == level) {
+        // A shared thunk read back at the same level has the same normal form
+        push_result(machine, retain_token(arg->normal));
+    } else {
+        push_task(machine, TASK_CACHE, NULL, NULL, level);
+        machine->tasks[machine->task_count - 1].thunk = arg;
+        push_task(machine, TASK_READ, arg->term, arg->env, level);
+    }
+}
+
+static void read_back(Machine* machine, const Instr* term, Env* env, u_int32_t level) {
+    size_t base = machine->depth;
+    machine_whnf(machine, &term, &env, base);
+
+    if (term->op == OP_LAM && machine->depth == base && !(machine->flags & MACHINE_WHNF) && machine->steps < machine->limit) {
+        // Reduce under the function with its varriable standing for itself
+        Thunk* var = new_var_thunk(machine, term->name, level);
+        push_task(machine, TASK_FUNCTION, term, NULL, level);
+        push_task(machine, TASK_READ, SHARED_TARGET(term + 1), extend_env(machine, var, env), level + 1);
+        return;
+    }
+
+    // Arguments of the head, the first one is on top of the stack
+    push_task(machine, TASK_ARGS, NULL, NULL, level);
+    machine->tasks[machine->task_count - 1].base = base;
+    machine->tasks[machine->task_count - 1].next = machine->depth;
+
+    if (term->op == OP_NAME) push_result(machine, make_var(term->name, 0));
+    // Stuck varriables, weak head functions and whatever was left when the steps ran out
+    else quote(machine, term, env, level);
+}
+
+/*Reads the closure back to a token, working through the tasks until the result is complete*/
+static BaseToken* run_read_back(Machine* machine, const Instr* term, Env* env) {
+    push_task(machine, TASK_READ, term, env, 0);
+
+    while (machine->task_count > 0) {
+        Task task = machine->tasks[--machine->task_count];
+        switch (task.kind) {
+        case TASK_READ:
+            read_back(machine, task.term, task.env, task.level);
+            break;
+        case TASK_QUOTE:
+            quote(machine, task.term, task.env, task.level);
+            break;
+        case TASK_FUNCTION: {
+            BaseToken* body = machine->results[--machine->result_count];
+            push_result(machine, make_function(task.term->name, body));
+            break;
+        }
+        case TASK_APPLY: {
+            BaseToken* value = machine->results[--machine->result_count];
+            BaseToken* func = machine->results[--machine->result_count];
+            push_result(machine, make_application(func, value));
+            break;
+        }
+        case TASK_ARGS:
+            if (task.next == task.base) {
+                machine->depth = task.base;
+                break;
+            }
+            // The head is applied to the next argument once it is read back
+            task.next--;
+            machine->tasks[machine->task_count++] = task;
+            push_task(machine, TASK_APPLY, NULL, NULL, task.level);
+            read_back_arg(machine, machine->stack[task.next], task.level);
+            break;
+        case TASK_CACHE: {
+            Thunk* arg = task.thunk;
+            if ((machine->flags & MACHINE_NEED) && !arg->normal && machine->steps < machine->limit) {
+                arg->normal = own_token(machine, retain_token(machine->results[machine->result_count - 1]));
+                arg->normal_level = task.level;
+            }
+            break;
+        }
+        }
+    }
+    return machine->results[--machine->result_count];
+}
+
+BaseToken* machine_eval(BaseToken* token, u_int64_t limit, int flags, HashTable* table) {
+    Machine machine;
+    memset(&machine, 0, sizeof(Machine));
+    machine.thunks.block_size = sizeof(Thunk);
+    machine.thunks.slab_blocks = 4096;
+    machine.envs.block_size = sizeof(Env);
+    machine.envs.slab_blocks = 8192;
+    machine.limit = limit;
+    machine.flags = flags;
+    machine.table = table;
+
+    Code* code = own_code(&machine, compile_code(token, table));
+    BaseToken* result = run_read_back(&machine, code->instrs, NULL);
+
+    for (size_t i = 0; i < machine.owned_count; i++)
+        free_token(machine.owned[i]);
+    free(machine.owned);
+    for (size_t i = 0; i < machine.code_count; i++)
+        free_code(machine.codes[i]);
+    free(machine.codes);
+    free(machine.updates);
+    free(machine.stack);
+    free(machine.tasks);
+    free(machine.results);
+    arena_free(&machine.thunks);
+    arena_free(&machine.envs);
+    return result;
+}
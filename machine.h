@@ -0,0 +1,86 @@
+#ifndef MACHINE
+#define MACHINE
+
+#include "lambda_calc.h"
+#include "arena.h"
+#include "code.h"
+
+/*Stop at the outermost function instead of reducing under it*/
+#define MACHINE_WHNF 1
+/*Call by need, every thunk is reduced at most once and then holds its value*/
+#define MACHINE_NEED 2
+
+/*Delayed value of a function argument, a closure of compiled code and the environment it was made in*/
+typedef struct Thunk {
+    const Instr* term; // NULL for the varriable of a function that is read back
+    struct Env* env;
+    Symbol name; // Name of the function varriable, used when term is NULL
+    u_int32_t level; // Number of functions above the varriable when term is NULL
+    u_int8_t evaluated; // Term and env already hold the weak head normal form
+    u_int32_t normal_level; // Level the normal form was read back at
+    BaseToken* normal; // Read back normal form in call by need, NULL until known
+} Thunk;
+
+/*Environment of a closure, entry n is the value of De Bruijn index n + 1*/
+typedef struct Env {
+    Thunk* value;
+    struct Env* next;
+} Env;
+
+/*Thunk being evaluated in call by need and the stack depth its evaluation started at*/
+typedef struct Update {
+    Thunk* thunk;
+    size_t depth;
+} Update;
+
+/*Kinds of read back tasks*/
+#define TASK_READ 0 // Read a closure back to normal form
+#define TASK_QUOTE 1 // Build the token of a closure without reducing it
+#define TASK_FUNCTION 2 // Wrap the last result in the function of term
+#define TASK_APPLY 3 // Apply the second to last result to the last one
+#define TASK_ARGS 4 // Apply the last result to the arguments of its spine
+#define TASK_CACHE 5 // Keep the last result as the normal form of the thunk
+
+/*Pending work of the read back, kept on a stack instead of the call stack so deep terms can be read back*/
+typedef struct Task {
+    u_int8_t kind;
+    const Instr* term;
+    Env* env;
+    u_int32_t level;
+    Thunk* thunk; // Thunk of TASK_CACHE
+    size_t base; // Stack depth the spine of TASK_ARGS started at
+    size_t next; // Arguments of TASK_ARGS not applied yet end here
+} Task;
+
+/*State of the environment machine*/
+typedef struct Machine {
+    NodeArena thunks; // Thunks and environment entries, released when the evaluation ends
+    NodeArena envs;
+    Thunk** stack; // Arguments waiting for a function, the top is the first argument
+    size_t depth;
+    size_t capacity;
+    Update* updates; // Thunks to overwrite once their value is reached
+    size_t update_depth;
+    size_t update_capacity;
+    BaseToken** owned; // Tokens the machine made for thunk values, released at the end
+    size_t owned_count;
+    size_t owned_capacity;
+    Task* tasks; // Read back still to do
+    size_t task_count;
+    size_t task_capacity;
+    BaseToken** results; // Tokens read back so far
+    size_t result_count;
+    size_t result_capacity;
+    Code** codes; // Code compiled during the evaluation, released at the end
+    size_t code_count;
+    size_t code_capacity;
+    HashTable* table; // Definitions free names are unfolded from, NULL to keep them free
+    u_int64_t steps; // Beta steps and unfolded definitions so far
+    u_int64_t limit; // Beta steps allowed
+    int flags; // MACHINE_WHNF and MACHINE_NEED
+} Machine;
+
+/*Evaluates the token to normal form(or weak head normal form) without substitution, defined names are run from their compiled code when table isn't NULL*/
+BaseToken* machine_eval(BaseToken* token, u_int64_t limit, int flags, HashTable* table);
+
+#endif
@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "lambda_calc.h"
+#include "memo.h"
+
+/*Values for argp*/
+const char *argp_program_version = "lambdacalc 0.1";
+const char *argp_program_bug_address = "<axowattle@gmail.com>";
+static char doc[] = "Lambda Calculus Calculator for linux using C";
+
+/*Options for argp*/
+static struct argp_option options[] = {
+    {"verbose", 'v', 0, 0, "Print the counters and phase times of every command after its result", 0},
+    {"loadfile",  'f', "FILE", 0, "Load File in the start", 0},
+    {"snapshot", 's', "IMAGE", 0, "Restore the table from IMAGE instead of parsing the load file while IMAGE is newer, rewrite IMAGE otherwise", 0},
+    {"batch", 'b', 0, 0, "Run the given files (or stdin) without the prompt, printing every result", 0},
+    {"jobs", 'j', "N", 0, "Evaluate up to N independent lines of a batch at once, 0 uses every core", 0},
+    {"memo", 'm', "BYTES", 0, "Memory the cache of br normal forms may use, 0 turns it off", 0},
+    {"print-length", 'l', "CHARS", 0, "Print at most CHARS characters of a result, the rest as ...", 0},
+    {"print-depth", 'd', "DEPTH", 0, "Print the parts of a result nested deeper than DEPTH as ...", 0},
+    {"share", 'S', 0, 0, "Print closed parts used more than once a single time, as ((\\s1.result) part)", 0},
+    {0}
+};
+
+/*Parse the given arguments into the struct*/
+static error_t parse_opt(int key, char *arg, struct argp_state *state);
+
+static char args_doc[] = "[FILE...]";
+
+static struct argp argp = {options, parse_opt, args_doc, doc, NULL, NULL, NULL};
+
+
+static error_t parse_opt(int key, char *arg, struct argp_state *state) {
+    struct arguments *arguments = state->input;
+
+    switch (key) {
+        case 'v': arguments->verbose = 1; break;
+        case 'f': arguments->load_file = arg; break;
+        case 's': arguments->snapshot = arg; break;
+        case 'b': arguments->batch = 1; break;
+        case 'j':
+            arguments->jobs = atoi(arg);
+            if (arguments->jobs < 0) argp_error(state, "the number of jobs can't be negative");
+            break;
+        case 'm': arguments->memo_budget = strtoull(arg, NULL, 10); break;
+        case 'l': arguments->print.max_length = strtoull(arg, NULL, 10); break;
+        case 'd': arguments->print.max_depth = strtoul(arg, NULL, 10); break;
+        case 'S': arguments->print.share = 1; break;
+        case ARGP_KEY_ARG:
+            arguments->files = realloc(arguments->files, sizeof(char*) * (arguments->file_count + 1));
+            if (!arguments->files) {
+                perror("Failed to allocate memory for arguments");
+                exit(EXIT_FAILURE);
+            }
+            arguments->files[arguments->file_count++] = arg;
+            break;
+        case ARGP_KEY_END:
+            if (arguments->file_count && !arguments->batch) argp_error(state, "input files are only run with --batch");
+            if (arguments->jobs != 1 && !arguments->batch) argp_error(state, "jobs are only used with --batch");
+            break;
+        default: return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]){
+    arguments args = {0};
+    args.jobs = 1;
+    args.memo_budget = MEMO_BUDGET;
+
+    argp_parse(&argp, argc, argv, 0, 0, &args);
+
+    if (args.batch) return batch_loop(args);
+    return input_loop(args);
+}
@@ -0,0 +1,347 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "memo.h"
+#include "stats.h"
+
+/*Batch workers look up and store at once, the entries and counters are only touched under the lock*/
+static pthread_mutex_t memo_lock = PTHREAD_MUTEX_INITIALIZER;
+static MemoEntry* buckets[MEMO_BUCKETS];
+static MemoEntry* newest;
+static MemoEntry* oldest;
+static MemoReport report = {.budget = MEMO_BUDGET};
+
+/*Node array of an entry being built, made by the storing thread before it takes the lock*/
+typedef struct MemoWriter {
+    MemoNode* nodes;
+    size_t count;
+    size_t capacity;
+    PointerMap ids; // Position plus one of every written token
+    BaseToken** stack;
+    size_t stack_count;
+    size_t stack_capacity;
+} MemoWriter;
+
+static void* grow_memo(void* array, size_t* capacity, size_t size, size_t needed) {
+    if (needed <= *capacity) return array;
+    while (*capacity < needed) *capacity = *capacity ? *capacity * 2 : 64;
+    array = realloc(array, *capacity * size);
+    if (!array) {
+        perror("Failed to allocate memory for normal form cache");
+        exit(EXIT_FAILURE);
+    }
+    return array;
+}
+
+static u_int32_t memo_id(MemoWriter* writer, BaseToken* token) {
+    return (size_t)pointer_map_get(&writer->ids, token) - 1;
+}
+
+/*Writes the token after its children, tokens already written for the term are shared by the result*/
+static u_int32_t add_memo_token(MemoWriter* writer, BaseToken* root) {
+    writer->stack_count = 0;
+    writer->stack = grow_memo(writer->stack, &writer->stack_capacity, sizeof(BaseToken*), 1);
+    writer->stack[writer->stack_count++] = root;
+
+    while (writer->stack_count > 0) {
+        BaseToken* token = writer->stack[writer->stack_count - 1];
+        if (pointer_map_get(&writer->ids, token)) {
+            writer->stack_count--;
+            continue;
+        }
+
+        int missing = 0;
+        for (int i = token->type - 1; i >= 0; i--) {
+            if (pointer_map_get(&writer->ids, token->in_values[i])) continue;
+            writer->stack = grow_memo(writer->stack, &writer->stack_capacity, sizeof(BaseToken*), writer->stack_count + 1);
+            writer->stack[writer->stack_count++] = token->in_values[i];
+            missing = 1;
+        }
+        if (missing) continue;
+
+        writer->nodes = grow_memo(writer->nodes, &writer->capacity, sizeof(MemoNode), writer->count + 1);
+        MemoNode* node = &writer->nodes[writer->count];
+        node->type = token->type;
+        node->symbol = token->symbol;
+        node->index = token->index;
+        node->in[0] = token->type > 0 ? memo_id(writer, token->in_values[0]) : 0;
+        node->in[1] = token->type > 1 ? memo_id(writer, token->in_values[1]) : 0;
+        pointer_map_put(&writer->ids, token, (void*)(writer->count + 1));
+        writer->count++;
+        writer->stack_count--;
+    }
+    return memo_id(writer, root);
+}
+
+static Symbol* add_dep(Symbol* deps, u_int32_t* count, size_t* capacity, Symbol symbol) {
+    for (u_int32_t i = 0; i < *count; i++) if (deps[i] == symbol) return deps;
+    deps = grow_memo(deps, capacity, sizeof(Symbol), *count + 1);
+    deps[(*count)++] = symbol;
+    return deps;
+}
+
+/*Definitions the written term uses, expanded ones are shared table tokens and the others are still free names*/
+static Symbol* term_deps(MemoWriter* writer, HashTable* table, int mode, u_int32_t* count) {
+    Symbol* deps = NULL;
+    size_t capacity = 0;
+    *count = 0;
+    for (size_t i = 0; i < writer->ids.capacity; i++) {
+        BaseToken* token = writer->ids.keys[i];
+        if (!token) continue;
+        if (token->type == 0 && token->index == 0 && get_variable_entry(table, token->symbol)) {
+            deps = add_dep(deps, count, &capacity, token->symbol);
+        } else if (token->arena == TABLE_ARENA) {
+            for (HashVarriable* entry = table->shapes[token->hash % SHAPE_TABLE_SIZE]; entry; entry = entry->next_shape) {
+                if (entry->value == token) deps = add_dep(deps, count, &capacity, entry->symbol);
+            }
+        }
+    }
+
+    // Native arithmetic depends on what every primitive is bound to
+    if (mode == REDUCE_DELTA) {
+        for (size_t i = 0; i < table->count; i++) {
+            if (table->entries[i]->prim) deps = add_dep(deps, count, &capacity, table->entries[i]->symbol);
+        }
+    }
+    return deps;
+}
+
+static void unlink_entry(MemoEntry* entry) {
+    MemoEntry** link = &buckets[entry->hash % MEMO_BUCKETS];
+    while (*link != entry) link = &(*link)->next_bucket;
+    *link = entry->next_bucket;
+
+    if (entry->newer) entry->newer->older = entry->older;
+    else newest = entry->older;
+    if (entry->older) entry->older->newer = entry->newer;
+    else oldest = entry->newer;
+}
+
+static void link_newest(MemoEntry* entry) {
+    entry->newer = NULL;
+    entry->older = newest;
+    if (newest) newest->newer = entry;
+    else oldest = entry;
+    newest = entry;
+}
+
+static void free_entry(MemoEntry* entry) {
+    free(entry->nodes);
+    free(entry->deps);
+    free(entry);
+}
+
+static void drop_entry(MemoEntry* entry) {
+    unlink_entry(entry);
+    report.entries--;
+    report.bytes -= entry->bytes;
+    if (entry->readers) entry->dropped = 1;
+    else free_entry(entry);
+}
+
+/*Drops the least recently used entries until the cache fits its budget*/
+static void evict(void) {
+    while (oldest && report.bytes > report.budget) {
+        drop_entry(oldest);
+        report.evictions++;
+    }
+}
+
+/*Pair of a token and the node it is compared against*/
+typedef struct MemoMatch {
+    BaseToken* token;
+    u_int32_t node;
+} MemoMatch;
+
+/*Stack of the comparison and the node every token was already matched with, kept by each thread between lookups*/
+static __thread MemoMatch* matches;
+static __thread size_t match_capacity;
+static __thread PointerMap matched;
+
+/*Checks that the stored term of the entry is alpha equivalent to the token without making any token
+Shared tokens are compared once against each node they meet, the stored term keeps the sharing of the token it was made from*/
+static int memo_equal(MemoEntry* entry, BaseToken* term) {
+    size_t count = 0;
+    int equal = 1;
+    matches = grow_memo(matches, &match_capacity, sizeof(MemoMatch), 1);
+    matches[count].token = term;
+    matches[count++].node = entry->term;
+
+    while (count > 0 && equal) {
+        MemoMatch match = matches[--count];
+        BaseToken* token = match.token;
+        MemoNode* node = &entry->nodes[match.node];
+        if ((uintptr_t)pointer_map_get(&matched, token) == (uintptr_t)match.node + 1) continue;
+
+        // Function names don't matter, bound varriables are compared by index and free ones by name
+        if (token->type != node->type) equal = 0;
+        else if (token->type == 0) equal = token->index == node->index && (token->index != 0 || token->symbol == node->symbol);
+        if (!equal || token->type == 0) continue;
+
+        // A pair that fails ends the whole comparison, so it can be marked before its children are checked
+        pointer_map_put(&matched, token, (void*)((uintptr_t)match.node + 1));
+        matches = grow_memo(matches, &match_capacity, sizeof(MemoMatch), count + 2);
+        for (int i = 0; i < token->type; i++) {
+            matches[count].token = token->in_values[i];
+            matches[count++].node = node->in[i];
+        }
+    }
+
+    // Only the slots are cleared, a map that grew large is given back
+    if (matched.capacity > MEMO_MATCH_KEEP) pointer_map_free(&matched);
+    else if (matched.count) {
+        memset(matched.keys, 0, matched.capacity * sizeof(void*));
+        matched.count = 0;
+    }
+    return equal;
+}
+
+/*Result of the entry, its tokens are made in the active arena*/
+static BaseToken* rebuild(MemoEntry* entry) {
+    BaseToken** tokens = calloc(entry->result + 1, sizeof(BaseToken*));
+    if (!tokens) {
+        perror("Failed to allocate memory for normal form cache");
+        exit(EXIT_FAILURE);
+    }
+    // Parents come after their children, so one pass down marks the nodes of the result and one pass up makes them
+    tokens[entry->result] = (BaseToken*)entry;
+    for (u_int32_t i = entry->result + 1; i-- > 0;) {
+        if (!tokens[i]) continue;
+        for (int j = 0; j < entry->nodes[i].type; j++) tokens[entry->nodes[i].in[j]] = (BaseToken*)entry;
+    }
+    for (u_int32_t i = 0; i <= entry->result; i++) {
+        if (!tokens[i]) continue;
+        MemoNode* node = &entry->nodes[i];
+        if (node->type == 0) tokens[i] = make_var(node->symbol, node->index);
+        else if (node->type == 1) tokens[i] = make_function(node->symbol, retain_token(tokens[node->in[0]]));
+        else tokens[i] = make_application(retain_token(tokens[node->in[0]]), retain_token(tokens[node->in[1]]));
+    }
+    BaseToken* result = retain_token(tokens[entry->result]);
+    for (u_int32_t i = 0; i <= entry->result; i++) free_token(tokens[i]);
+    free(tokens);
+    return result;
+}
+
+void memo_free_thread(void) {
+    free(matches);
+    matches = NULL;
+    match_capacity = 0;
+    pointer_map_free(&matched);
+}
+
+BaseToken* memo_lookup(BaseToken* term, int mode, u_int64_t limit) {
+    pthread_mutex_lock(&memo_lock);
+    if (report.budget == 0) {
+        pthread_mutex_unlock(&memo_lock);
+        return NULL;
+    }
+    for (MemoEntry* entry = buckets[term->hash % MEMO_BUCKETS]; entry; entry = entry->next_bucket) {
+        if (entry->hash != term->hash || entry->mode != mode) continue;
+        if (entry->limit != limit && !(entry->completed && entry->steps <= limit)) continue;
+        // Hashes can collide
+        if (!memo_equal(entry, term)) continue;
+
+        unlink_entry(entry);
+        entry->next_bucket = buckets[entry->hash % MEMO_BUCKETS];
+        buckets[entry->hash % MEMO_BUCKETS] = entry;
+        link_newest(entry);
+        report.hits++;
+        STAT_ADD(memo_hits, 1);
+
+        // The entry stays alive while the result is made without the lock, even when it is dropped meanwhile
+        entry->readers++;
+        pthread_mutex_unlock(&memo_lock);
+        BaseToken* result = rebuild(entry);
+        pthread_mutex_lock(&memo_lock);
+        entry->readers--;
+        if (entry->dropped && entry->readers == 0) free_entry(entry);
+        pthread_mutex_unlock(&memo_lock);
+        return result;
+    }
+    report.misses++;
+    STAT_ADD(memo_misses, 1);
+    pthread_mutex_unlock(&memo_lock);
+    return NULL;
+}
+
+void memo_store(BaseToken* term, BaseToken* result, int mode, u_int64_t limit, u_int64_t steps, int completed, HashTable* table) {
+    pthread_mutex_lock(&memo_lock);
+    size_t budget = report.budget;
+    pthread_mutex_unlock(&memo_lock);
+    if (budget == 0) return;
+
+    // The arrays are built without the lock, only linking the entry in needs it
+    MemoWriter writer = {0};
+    MemoEntry* entry = calloc(1, sizeof(MemoEntry));
+    if (!entry) {
+        perror("Failed to allocate memory for normal form cache");
+        exit(EXIT_FAILURE);
+    }
+    entry->term = add_memo_token(&writer, term);
+    entry->deps = term_deps(&writer, table, mode, &entry->dep_count);
+    entry->result = add_memo_token(&writer, result);
+    entry->nodes = writer.nodes;
+    entry->node_count = writer.count;
+    entry->hash = term->hash;
+    entry->mode = mode;
+    entry->limit = limit;
+    entry->steps = steps;
+    entry->completed = completed;
+    entry->bytes = sizeof(MemoEntry) + writer.count * sizeof(MemoNode) + entry->dep_count * sizeof(Symbol);
+    free(writer.stack);
+    pointer_map_free(&writer.ids);
+
+    pthread_mutex_lock(&memo_lock);
+    if (entry->bytes > report.budget || writer.count >= UINT32_MAX) {
+        pthread_mutex_unlock(&memo_lock);
+        free_entry(entry);
+        return;
+    }
+    entry->next_bucket = buckets[entry->hash % MEMO_BUCKETS];
+    buckets[entry->hash % MEMO_BUCKETS] = entry;
+    link_newest(entry);
+    report.entries++;
+    report.bytes += entry->bytes;
+    evict();
+    pthread_mutex_unlock(&memo_lock);
+}
+
+void memo_invalidate(Symbol symbol) {
+    pthread_mutex_lock(&memo_lock);
+    MemoEntry* entry = newest;
+    while (entry) {
+        MemoEntry* older = entry->older;
+        for (u_int32_t i = 0; i < entry->dep_count; i++) {
+            if (entry->deps[i] != symbol) continue;
+            drop_entry(entry);
+            report.invalidations++;
+            break;
+        }
+        entry = older;
+    }
+    pthread_mutex_unlock(&memo_lock);
+}
+
+void memo_set_budget(size_t budget) {
+    pthread_mutex_lock(&memo_lock);
+    report.budget = budget;
+    evict();
+    pthread_mutex_unlock(&memo_lock);
+}
+
+void memo_report(MemoReport* out) {
+    pthread_mutex_lock(&memo_lock);
+    *out = report;
+    pthread_mutex_unlock(&memo_lock);
+}
+
+void memo_clear(void) {
+    pthread_mutex_lock(&memo_lock);
+    while (oldest) drop_entry(oldest);
+    size_t budget = report.budget;
+    memset(&report, 0, sizeof(MemoReport));
+    report.budget = budget;
+    pthread_mutex_unlock(&memo_lock);
+}
@@ -0,0 +1,75 @@
+#ifndef MEMO
+#define MEMO
+
+#include "lambda_calc.h"
+
+/*Bytes the cache of normal forms may use unless --memo says otherwise*/
+#define MEMO_BUDGET (64 << 20)
+/*Buckets of the cache by the hash of the reduced term*/
+#define MEMO_BUCKETS 1024
+/*Slots the map of a lookup comparison may keep between lookups of a thread*/
+#define MEMO_MATCH_KEEP 4096
+
+/*Token of a cached term, children come before their parents and are referred to by their position*/
+typedef struct MemoNode {
+    u_int8_t type;
+    Symbol symbol;
+    u_int32_t index;
+    u_int32_t in[2];
+} MemoNode;
+
+/*Reduced term and its result, kept outside of the token arenas so every thread can store and rebuild them*/
+typedef struct MemoEntry {
+    u_int32_t hash; // Alpha invariant hash of the reduced term
+    u_int8_t mode; // Reduction the result was made with, a term is only looked up under the same one
+    u_int8_t completed; // The result is a normal form reached in steps reductions
+    u_int64_t limit;
+    u_int64_t steps;
+    MemoNode* nodes; // Term and result share one array, parts of the term left in the result are stored once
+    u_int32_t node_count;
+    u_int32_t term;
+    u_int32_t result;
+    Symbol* deps; // Definitions the term was expanded from and bound primitives, redefining one drops the entry
+    u_int32_t dep_count;
+    size_t bytes;
+    u_int32_t readers; // Lookups rebuilding the result outside of the lock, a dropped entry is freed by the last one
+    u_int8_t dropped;
+    struct MemoEntry* newer; // Least recently used list
+    struct MemoEntry* older;
+    struct MemoEntry* next_bucket;
+} MemoEntry;
+
+/*Counters of the cache since it was last cleared*/
+typedef struct MemoReport {
+    size_t entries;
+    size_t bytes;
+    size_t budget;
+    u_int64_t hits;
+    u_int64_t misses;
+    u_int64_t evictions; // Entries dropped to stay under the budget
+    u_int64_t invalidations; // Entries dropped because a definition changed
+} MemoReport;
+
+/*Result of the term reduced under the mode with the given limit, NULL when it isn't cached
+A normal form reached in fewer steps also answers a larger limit*/
+BaseToken* memo_lookup(BaseToken* term, int mode, u_int64_t limit);
+
+/*Frees what the lookups of the calling thread keep between calls*/
+void memo_free_thread(void);
+
+/*Caches the result of the term, completed when it is a normal form reached in steps reductions*/
+void memo_store(BaseToken* term, BaseToken* result, int mode, u_int64_t limit, u_int64_t steps, int completed, HashTable* table);
+
+/*Drops every entry depending on the definition*/
+void memo_invalidate(Symbol symbol);
+
+/*Sets the bytes the cache may use, 0 turns it off, older entries are dropped until it fits*/
+void memo_set_budget(size_t budget);
+
+/*Copies the counters of the cache*/
+void memo_report(MemoReport* out);
+
+/*Drops every entry and clears the counters*/
+void memo_clear(void);
+
+#endif
@@ -0,0 +1,420 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "net.h"
+
+#define PORT(node, slot) ((NetPort)((node) * 4 + (slot)))
+#define PORT_NODE(port) ((port) >> 2)
+#define PORT_SLOT(port) ((port) & 3)
+
+static void* grow_array(void* array, size_t* capacity, size_t size, size_t initial) {
+    *capacity = *capacity ? *capacity * 2 : initial;
+    array = realloc(array, *capacity * size);
+    if (!array) {
+        perror("Failed to allocate memory for net");
+        exit(EXIT_FAILURE);
+    }
+    return array;
+}
+
+static u_int32_t new_node(Net* net, u_int8_t kind) {
+    u_int32_t node;
+    if (net->free_list) {
+        node = net->free_list;
+        net->free_list = net->nodes[node].ports[0];
+    } else {
+        if (net->count == net->capacity)
+            net->nodes = grow_array(net->nodes, &net->capacity, sizeof(NetNode), 1024);
+        node = net->count++;
+    }
+    memset(&net->nodes[node], 0, sizeof(NetNode));
+    net->nodes[node].kind = kind;
+    return node;
+}
+
+static void free_node(Net* net, u_int32_t node) {
+    net->nodes[node].kind = NET_FREE_NODE;
+    net->nodes[node].ports[0] = net->free_list;
+    net->free_list = node;
+}
+
+static NetPort partner(Net* net, NetPort port) {
+    return net->nodes[PORT_NODE(port)].ports[PORT_SLOT(port)];
+}
+
+/*Free names stay in place when applied, every other pair of principal ports rewrites*/
+static int has_rule(u_int8_t a, u_int8_t b) {
+    if (a == NET_NAME) return b == NET_DUP || b == NET_ERA;
+    if (b == NET_NAME) return a == NET_DUP || a == NET_ERA;
+    return 1;
+}
+
+static void link_ports(Net* net, NetPort a, NetPort b) {
+    net->nodes[PORT_NODE(a)].ports[PORT_SLOT(a)] = b;
+    net->nodes[PORT_NODE(b)].ports[PORT_SLOT(b)] = a;
+}
+
+/*Wire ending in a varriable occurrence, queued until a later occurrence splits it*/
+typedef struct NetLeaf {
+    NetPort port;
+    size_t next; // Index of the next leaf plus one, 0 ends the queue
+} NetLeaf;
+
+/*Translation scope entry, the function node and the queue of wires its varriable occurrences hang off*/
+typedef struct NetScope {
+    u_int32_t lam;
+    size_t head;
+    size_t tail;
+} NetScope;
+
+static void push_task(Net* net, u_int8_t kind, u_int32_t node, u_int32_t depth) {
+    if (net->task_count == net->task_capacity)
+        net->tasks = grow_array(net->tasks, &net->task_capacity, sizeof(NetTask), 256);
+    NetTask* task = &net->tasks[net->task_count++];
+    memset(task, 0, sizeof(NetTask));
+    task->kind = kind;
+    task->node = node;
+    task->depth = depth;
+}
+
+static void push_port(Net* net, NetPort port) {
+    if (net->port_count == net->port_capacity)
+        net->ports = grow_array(net->ports, &net->port_capacity, sizeof(NetPort), 256);
+    net->ports[net->port_count++] = port;
+}
+
+static void push_leaf(NetLeaf** leaves, size_t* count, size_t* capacity, NetScope* scope, NetPort port) {
+    if (*count == *capacity) *leaves = grow_array(*leaves, capacity, sizeof(NetLeaf), 256);
+    (*leaves)[*count].port = port;
+    (*leaves)[*count].next = 0;
+    (*count)++;
+    if (scope->head) (*leaves)[scope->tail - 1].next = *count;
+    else scope->head = *count;
+    scope->tail = *count;
+}
+
+/*Builds the net of the token and returns the port its value comes out of*/
+static NetPort translate(Net* net, BaseToken* token) {
+    NetScope* scopes = NULL;
+    size_t capacity = 0;
+    NetLeaf* leaves = NULL;
+    size_t leaf_count = 0;
+    size_t leaf_capacity = 0;
+    push_task(net, NET_TASK_BUILD, 0, 0);
+    net->tasks[0].token = token;
+
+    while (net->task_count > 0) {
+        NetTask task = net->tasks[--net->task_count];
+        token = task.token;
+        size_t depth = task.depth;
+
+        if (task.kind == NET_TASK_LINK) {
+            link_ports(net, PORT(task.node, task.slot), net->ports[--net->port_count]);
+            continue;
+        }
+        if (task.kind == NET_TASK_RESULT) {
+            push_port(net, PORT(task.node, 2));
+            continue;
+        }
+        if (task.kind == NET_TASK_BODY) {
+            link_ports(net, PORT(task.node, 2), net->ports[--net->port_count]);
+            if (!scopes[depth].head) {
+                u_int32_t era = new_node(net, NET_ERA);
+                link_ports(net, PORT(era, 0), PORT(task.node, 1));
+            }
+            push_port(net, PORT(task.node, 0));
+            continue;
+        }
+
+        if (token->type == 0 && token->index == 0) {
+            u_int32_t name = new_node(net, NET_NAME);
+            net->nodes[name].name = token->symbol;
+            push_port(net, PORT(name, 0));
+        } else if (token->type == 0) {
+            // The first occurrence takes the varriable port, later ones split the oldest wire with a duplicator
+            // so the duplicators form a balanced tree and each occurrence is read back through few of them
+            NetScope* scope = &scopes[depth - token->index];
+            NetPort port = PORT(scope->lam, 1);
+            if (scope->head) {
+                NetPort split = leaves[scope->head - 1].port;
+                scope->head = leaves[scope->head - 1].next;
+                NetPort site = partner(net, split);
+                u_int32_t dup = new_node(net, NET_DUP);
+                net->nodes[dup].label = net->next_label++;
+                link_ports(net, PORT(dup, 0), split);
+                link_ports(net, PORT(dup, 1), site);
+                push_leaf(&leaves, &leaf_count, &leaf_capacity, scope, PORT(dup, 1));
+                port = PORT(dup, 2);
+            }
+            push_leaf(&leaves, &leaf_count, &leaf_capacity, scope, port);
+            // The occurrence is linked before the next one splits its wire
+            push_port(net, port);
+        } else if (token->type == 1) {
+            u_int32_t lam = new_node(net, NET_LAM);
+            net->nodes[lam].name = token->symbol;
+            if (depth == capacity) scopes = grow_array(scopes, &capacity, sizeof(NetScope), 64);
+            scopes[depth].lam = lam;
+            scopes[depth].head = 0;
+            push_task(net, NET_TASK_BODY, lam, depth);
+            push_task(net, NET_TASK_BUILD, 0, depth + 1);
+            net->tasks[net->task_count - 1].token = token->in_values[0];
+        } else {
+            u_int32_t app = new_node(net, NET_APP);
+            push_task(net, NET_TASK_RESULT, app, depth);
+            push_task(net, NET_TASK_LINK, app, depth);
+            net->tasks[net->task_count - 1].slot = 1;
+            push_task(net, NET_TASK_BUILD, 0, depth);
+            net->tasks[net->task_count - 1].token = token->in_values[1];
+            push_task(net, NET_TASK_LINK, app, depth);
+            push_task(net, NET_TASK_BUILD, 0, depth);
+            net->tasks[net->task_count - 1].token = token->in_values[0];
+        }
+    }
+    free(scopes);
+    free(leaves);
+    return net->ports[--net->port_count];
+}
+
+/*Connects the matching auxiliary ports of the two nodes, beta reduction when a function meets an application*/
+static void annihilate(Net* net, u_int32_t a, u_int32_t b) {
+    // Partners are read again after every link since an auxiliary port can be wired to the other node
+    link_ports(net, partner(net, PORT(a, 1)), partner(net, PORT(b, 1)));
+    link_ports(net, partner(net, PORT(a, 2)), partner(net, PORT(b, 2)));
+}
+
+/*Each node passes through the other, leaving two copies of both*/
+static void commute(Net* net, u_int32_t a, u_int32_t b) {
+    u_int32_t a1 = new_node(net, net->nodes[a].kind);
+    u_int32_t a2 = new_node(net, net->nodes[a].kind);
+    u_int32_t b1 = new_node(net, net->nodes[b].kind);
+    u_int32_t b2 = new_node(net, net->nodes[b].kind);
+    net->nodes[a1].label = net->nodes[a2].label = net->nodes[a].label;
+    net->nodes[a1].name = net->nodes[a2].name = net->nodes[a].name;
+    net->nodes[b1].label = net->nodes[b2].label = net->nodes[b].label;
+    net->nodes[b1].name = net->nodes[b2].name = net->nodes[b].name;
+
+    link_ports(net, PORT(a1, 1), PORT(b1, 1));
+    link_ports(net, PORT(a1, 2), PORT(b2, 1));
+    link_ports(net, PORT(a2, 1), PORT(b1, 2));
+    link_ports(net, PORT(a2, 2), PORT(b2, 2));
+    link_ports(net, PORT(a1, 0), partner(net, PORT(b, 1)));
+    link_ports(net, PORT(a2, 0), partner(net, PORT(b, 2)));
+    link_ports(net, PORT(b1, 0), partner(net, PORT(a, 1)));
+    link_ports(net, PORT(b2, 0), partner(net, PORT(a, 2)));
+}
+
+/*Copies a node without auxiliary ports onto both auxiliary ports of the other*/
+static void spread(Net* net, u_int32_t leaf, u_int32_t node) {
+    for (int slot = 1; slot <= 2; slot++) {
+        u_int32_t copy = new_node(net, net->nodes[leaf].kind);
+        net->nodes[copy].name = net->nodes[leaf].name;
+        link_ports(net, PORT(copy, 0), partner(net, PORT(node, slot)));
+    }
+}
+
+static void interact(Net* net, u_int32_t a, u_int32_t b) {
+    if (net->nodes[a].kind > net->nodes[b].kind) {
+        u_int32_t swap = a;
+        a = b;
+        b = swap;
+    }
+    u_int8_t ka = net->nodes[a].kind;
+    u_int8_t kb = net->nodes[b].kind;
+
+    if (ka == NET_LAM && kb == NET_APP) {
+        annihilate(net, a, b);
+        net->steps++;
+    } else if (kb == NET_ERA || kb == NET_NAME) {
+        // Two leaves cancel, a leaf and a node leave a leaf on both auxiliary ports
+        if (ka != NET_ERA && ka != NET_NAME) spread(net, b, a);
+    } else if (ka == kb && net->nodes[a].label == net->nodes[b].label) {
+        annihilate(net, a, b);
+    } else {
+        commute(net, a, b);
+    }
+    net->interactions++;
+    free_node(net, a);
+    free_node(net, b);
+}
+
+static NetPath* cons_path(Net* net, u_int32_t key, u_int32_t value, NetPath* next) {
+    NetPath* path = arena_alloc(&net->paths);
+    path->key = key;
+    path->value = value;
+    path->next = next;
+    return path;
+}
+
+/*Removes the newest entry with the key, the entries before it are copied so other branches keep the old list*/
+static NetPath* take_path(Net* net, NetPath* path, u_int32_t key, u_int32_t* value) {
+    NetPath* found = path;
+    while (found && found->key != key) found = found->next;
+    if (!found) return NULL;
+    *value = found->value;
+
+    NetPath* copy = NULL;
+    NetPath** tail = &copy;
+    for (; path != found; path = path->next) {
+        *tail = cons_path(net, path->key, path->value, NULL);
+        tail = &(*tail)->next;
+    }
+    *tail = found->next;
+    return copy;
+}
+
+/*Rewrites the pair if the two ports are principal ports facing each other and the budget allows it*/
+static int try_interact(Net* net, NetPort from, NetPort to) {
+    if (PORT_SLOT(from) != 0 || PORT_SLOT(to) != 0) return 0;
+    if (!has_rule(net->nodes[PORT_NODE(from)].kind, net->nodes[PORT_NODE(to)].kind)) return 0;
+    // Duplication has no beta step of its own, it gets a generous share of the budget
+    if (net->steps >= net->limit || net->interactions >= net->limit * 1024 + 4096) return 0;
+    interact(net, PORT_NODE(from), PORT_NODE(to));
+    return 1;
+}
+
+static void push_trail(Net* net, NetPort from, NetPath* dups) {
+    if (net->trail_depth == net->trail_capacity)
+        net->trail = grow_array(net->trail, &net->trail_capacity, sizeof(NetTrail), 256);
+    net->trail[net->trail_depth].from = from;
+    net->trail[net->trail_depth].dups = dups;
+    net->trail_depth++;
+}
+
+static void push_result(Net* net, BaseToken* token) {
+    if (net->result_count == net->result_capacity)
+        net->results = grow_array(net->results, &net->result_capacity, sizeof(BaseToken*), 256);
+    net->results[net->result_count++] = token;
+}
+
+static void push_read(Net* net, NetPort port, NetPath* dups, NetPath* binders, u_int32_t depth) {
+    push_task(net, NET_TASK_READ, 0, depth);
+    NetTask* task = &net->tasks[net->task_count - 1];
+    task->port = port;
+    task->dups = dups;
+    task->binders = binders;
+}
+
+/*Walks from the port to the head of the term connected to it, reducing only the pairs met on the way*/
+static int read_head(Net* net, NetTask* task) {
+    size_t base = net->trail_depth;
+    push_trail(net, task->port, task->dups);
+    NetPath* binders = task->binders;
+    u_int32_t depth = task->depth;
+
+    // Applications the walk goes through take their arguments once the head is known
+    push_task(net, NET_TASK_ARGS, 0, depth);
+    net->tasks[net->task_count - 1].binders = binders;
+    net->tasks[net->task_count - 1].base = base;
+
+    // A broken net can send the walk around a loop of duplicators
+    size_t walk = 0;
+    while (walk++ <= net->count * 2) {
+        NetPort from = net->trail[net->trail_depth - 1].from;
+        NetPath* dups = net->trail[net->trail_depth - 1].dups;
+        NetPort to = partner(net, from);
+
+        // The node the walk came from is gone, the walk goes on from the one before it
+        if (try_interact(net, from, to)) {
+            net->trail_depth--;
+            walk = 0;
+            continue;
+        }
+
+        NetNode* node = &net->nodes[PORT_NODE(to)];
+        u_int32_t slot = PORT_SLOT(to);
+
+        if (node->kind == NET_NAME) {
+            push_result(net, make_var(node->name, 0));
+            return 1;
+        } else if (node->kind == NET_LAM && slot == 0) {
+            NetPath* inner = cons_path(net, PORT_NODE(to), depth + 1, binders);
+            push_task(net, NET_TASK_WRAP, PORT_NODE(to), depth);
+            push_read(net, PORT(PORT_NODE(to), 2), dups, inner, depth + 1);
+            return 1;
+        } else if (node->kind == NET_LAM && slot == 1) {
+            for (NetPath* binder = binders; binder; binder = binder->next) {
+                if (binder->key == PORT_NODE(to)) {
+                    push_result(net, make_var(node->name, depth - binder->value + 1));
+                    return 1;
+                }
+            }
+            return 0;
+        } else if (node->kind == NET_APP && slot == 2) {
+            // The value of an application comes from its function
+            push_trail(net, PORT(PORT_NODE(to), 0), dups);
+        } else if (node->kind == NET_DUP && slot != 0) {
+            // Entering a duplicator through a copy, the copy is taken again when the walk leaves through it
+            push_trail(net, PORT(PORT_NODE(to), 0), cons_path(net, node->label, slot, dups));
+        } else if (node->kind == NET_DUP) {
+            u_int32_t copy = 0;
+            dups = take_path(net, dups, node->label, &copy);
+            if (!copy) return 0;
+            push_trail(net, PORT(PORT_NODE(to), copy), dups);
+        } else {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+/*Reads back the term connected to the port, working through the tasks until the result is complete*/
+static BaseToken* read_back(Net* net, NetPort start) {
+    push_read(net, start, NULL, NULL, 0);
+
+    int failed = 0;
+    while (net->task_count > 0 && !failed) {
+        NetTask task = net->tasks[--net->task_count];
+
+        if (task.kind == NET_TASK_READ) {
+            failed = !read_head(net, &task);
+        } else if (task.kind == NET_TASK_WRAP) {
+            BaseToken* body = net->results[--net->result_count];
+            push_result(net, make_function(net->nodes[task.node].name, body));
+        } else if (task.kind == NET_TASK_APPLY) {
+            BaseToken* value = net->results[--net->result_count];
+            BaseToken* func = net->results[--net->result_count];
+            push_result(net, make_application(func, value));
+        } else {
+            // Every application the walk went through takes its argument, innermost first
+            if (task.next == 0) task.next = net->trail_depth;
+            while (task.next > task.base + 1 && net->nodes[PORT_NODE(net->trail[task.next - 1].from)].kind != NET_APP)
+                task.next--;
+            if (task.next <= task.base + 1) {
+                net->trail_depth = task.base;
+                continue;
+            }
+            NetTrail* entry = &net->trail[--task.next];
+            net->tasks[net->task_count++] = task;
+            push_task(net, NET_TASK_APPLY, 0, task.depth);
+            push_read(net, PORT(PORT_NODE(entry->from), 1), entry->dups, task.binders, task.depth);
+        }
+    }
+
+    if (failed) {
+        while (net->result_count > 0) free_token(net->results[--net->result_count]);
+        return NULL;
+    }
+    return net->results[--net->result_count];
+}
+
+BaseToken* net_reduce(BaseToken* token, u_int64_t limit) {
+    Net net;
+    memset(&net, 0, sizeof(Net));
+    net.paths.block_size = sizeof(NetPath);
+    net.paths.slab_blocks = 4096;
+    net.limit = limit;
+
+    // Node 0 is the root so a free list index of 0 means empty
+    u_int32_t root = new_node(&net, NET_ROOT);
+    link_ports(&net, PORT(root, 1), translate(&net, token));
+
+    BaseToken* result = read_back(&net, PORT(root, 1));
+
+    free(net.nodes);
+    free(net.trail);
+    free(net.tasks);
+    free(net.ports);
+    free(net.results);
+    arena_free(&net.paths);
+    return result;
+}
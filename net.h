@@ -0,0 +1,90 @@
+#ifndef NET
+#define NET
+
+#include "lambda_calc.h"
+#include "arena.h"
+
+/*Kinds of interaction net nodes*/
+#define NET_FREE_NODE 0 // Unused slot
+#define NET_ROOT 1 // Holds the output of the whole term on port 1
+#define NET_LAM 2 // Port 0 the function, 1 its varriable, 2 its body
+#define NET_APP 3 // Port 0 the applied function, 1 the argument, 2 the result
+#define NET_DUP 4 // Port 0 the duplicated value, 1 and 2 the copies
+#define NET_ERA 5 // Port 0 only, erases what it touches
+#define NET_NAME 6 // Port 0 only, a free name of the term
+
+/*Port address of a node slot, node index times 4 plus the slot*/
+typedef u_int32_t NetPort;
+
+typedef struct NetNode {
+    u_int8_t kind;
+    u_int32_t label; // Duplicators only interact with duplicators of the same label by annihilation
+    Symbol name; // Function varriable or free name
+    NetPort ports[3]; // Port each slot is connected to
+} NetNode;
+
+/*Persistent list entry of the read back, a duplicator label and the copy taken or a function node and its depth*/
+typedef struct NetPath {
+    u_int32_t key;
+    u_int32_t value;
+    struct NetPath* next;
+} NetPath;
+
+/*Port the read back walked out of and the duplicator copies taken up to it*/
+typedef struct NetTrail {
+    NetPort from;
+    NetPath* dups;
+} NetTrail;
+
+/*Kinds of net tasks, kept on a stack instead of the call stack so deep terms can be translated and read back*/
+#define NET_TASK_BUILD 0 // Translate the token
+#define NET_TASK_LINK 1 // Link the last port to the slot of the node
+#define NET_TASK_BODY 2 // Link the last port to the body of the function node
+#define NET_TASK_RESULT 3 // The result of the application node is the next port
+#define NET_TASK_READ 4 // Read back the term connected to the port
+#define NET_TASK_WRAP 5 // Wrap the last token in the function node
+#define NET_TASK_APPLY 6 // Apply the second to last token to the last one
+#define NET_TASK_ARGS 7 // Apply the last token to the arguments found on the trail
+
+typedef struct NetTask {
+    u_int8_t kind;
+    BaseToken* token;
+    u_int32_t node;
+    u_int32_t slot;
+    u_int32_t depth; // Functions above the token or the read back port
+    NetPort port;
+    NetPath* dups;
+    NetPath* binders;
+    size_t base; // Trail entries of NET_TASK_ARGS start above base
+    size_t next; // and end at next, 0 until the first argument is taken
+} NetTask;
+
+/*Interaction net, reduced on demand while it is read back*/
+typedef struct Net {
+    NetNode* nodes;
+    size_t count;
+    size_t capacity;
+    u_int32_t free_list; // Index of a free node, linked through ports[0]
+    NetTrail* trail; // Walks of the read back, each call keeps the part above its base
+    size_t trail_depth;
+    size_t trail_capacity;
+    NetTask* tasks;
+    size_t task_count;
+    size_t task_capacity;
+    NetPort* ports; // Ports of translated tokens
+    size_t port_count;
+    size_t port_capacity;
+    BaseToken** results; // Tokens read back so far
+    size_t result_count;
+    size_t result_capacity;
+    u_int32_t next_label;
+    u_int64_t limit; // Budget of beta interactions
+    u_int64_t steps; // Beta interactions
+    u_int64_t interactions; // All interactions
+    NodeArena paths; // Duplicator and binder lists of the read back
+} Net;
+
+/*Reduces the token as an interaction net, NULL when the net couldn't be read back*/
+BaseToken* net_reduce(BaseToken* token, u_int64_t limit);
+
+#endif
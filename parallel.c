@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "parallel.h"
+#include "pool.h"
+#include "stats.h"
+
+static WorkerPool* reduce_pool;
+/*Held by the thread using the pool, a batch worker that finds it taken reduces on its own*/
+static pthread_mutex_t reduce_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t reduce_epoch;
+static u_int8_t next_arena = WORKER_ARENA;
+
+/*Arena of the worker thread, 0 until its first task*/
+static __thread u_int8_t worker_arena;
+/*Reduction the tokens of the worker arena belong to*/
+static __thread size_t worker_epoch;
+
+static void* par_alloc(size_t size) {
+    void* block = calloc(1, size);
+    if (!block) {
+        perror("Failed to allocate memory for parallel reduction");
+        exit(EXIT_FAILURE);
+    }
+    return block;
+}
+
+/*Takes one reduction from the budget, 0 when it is used up*/
+static int reserve_step(ParRun* run) {
+    if (__atomic_fetch_add(&run->steps, 1, __ATOMIC_RELAXED) < run->limit) return 1;
+    __atomic_fetch_sub(&run->steps, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/*Reduces the leftmost outermost redex if the budget allows it*/
+static int reduce_step(ParRun* run, BaseToken** term) {
+    if (!reserve_step(run)) return 0;
+    if (beta_reduction_search(term)) return 1;
+    __atomic_fetch_sub(&run->steps, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/*Head of the term below its functions and applications*/
+static BaseToken* term_head(BaseToken* term) {
+    while (term->type == 1) term = term->in_values[0];
+    while (term->type == 2) term = term->in_values[0];
+    return term;
+}
+
+/*Puts the normal forms of the arguments back under the head and the functions around it*/
+static BaseToken* rebuild(ParTask* task) {
+    size_t function_count = 0;
+    for (BaseToken* term = task->head; term->type == 1; term = term->in_values[0]) function_count++;
+    BaseToken** functions = par_alloc(sizeof(BaseToken*) * (function_count + 1));
+    BaseToken* term = task->head;
+    for (size_t i = 0; i < function_count; i++, term = term->in_values[0]) functions[i] = term;
+
+    // Results of other threads are borrowed, a result of this one gets the reference make_application takes over
+    BaseToken* result = retain_token(term_head(term));
+    for (u_int32_t i = 0; i < task->arg_count; i++) result = make_application(result, retain_token(task->args[i]));
+    for (size_t i = function_count; i > 0; i--) result = make_function(functions[i - 1]->symbol, result);
+
+    free(functions);
+    return result;
+}
+
+/*Hands the result to the parent, the last argument of a parent to finish rebuilds it and goes on upwards*/
+static void finish(ParTask* task, BaseToken* result, ParRun* run) {
+    while (1) {
+        ParTask* parent = task->parent;
+        u_int32_t slot = task->slot;
+        free(task->args);
+        free(task);
+        if (!parent) {
+            run->result = result;
+            return;
+        }
+
+        parent->args[slot] = result;
+        if (__atomic_sub_fetch(&parent->pending, 1, __ATOMIC_ACQ_REL) != 0) return;
+        result = rebuild(parent);
+        task = parent;
+    }
+}
+
+/*Tokens are never released during a reduction since other workers may borrow them, the whole arena goes when the next one starts*/
+static void prepare_worker(ParRun* run) {
+    if (!worker_arena) {
+        worker_arena = __atomic_fetch_add(&next_arena, 1, __ATOMIC_RELAXED);
+        use_worker_arena(worker_arena);
+    }
+    if (worker_epoch != run->epoch) {
+        end_command();
+        worker_epoch = run->epoch;
+    }
+}
+
+static void normalize_task(ParTask* task, ParRun* run) {
+
+    BaseToken* term = retain_token(task->term);
+
+    // Small terms aren't worth the tasks, they are reduced here until they are normal or grow big enough to split
+    while (term->size < PAR_SERIAL_SIZE) {
+        if (!reduce_step(run, &term)) {
+            finish(task, term, run);
+            return;
+        }
+    }
+
+    while (term_head(term)->type != 0 && reduce_step(run, &term));
+    BaseToken* spine = term;
+    while (spine->type == 1) spine = spine->in_values[0];
+    u_int32_t arg_count = 0;
+    for (BaseToken* app = spine; app->type == 2; app = app->in_values[0]) arg_count++;
+    if (term_head(term)->type != 0 || arg_count == 0) {
+        finish(task, term, run);
+        return;
+    }
+
+    // The arguments of a head normal form never meet again, each is normalized on its own
+    task->head = term;
+    task->arg_count = arg_count;
+    task->pending = arg_count;
+    task->args = par_alloc(sizeof(BaseToken*) * arg_count);
+    u_int32_t slot = arg_count;
+    for (BaseToken* app = spine; app->type == 2; app = app->in_values[0]) {
+        ParTask* child = par_alloc(sizeof(ParTask));
+        child->term = app->in_values[1];
+        child->parent = task;
+        child->slot = --slot;
+        steal_push(child);
+    }
+}
+
+static void run_task(void* data, void* shared) {
+    prepare_worker(shared);
+    normalize_task(data, shared);
+    // Workers have no commands of their own, their counters go straight to the totals
+    stats_flush();
+}
+
+static void free_worker(void) {
+    free_thread_arenas();
+}
+
+BaseToken* par_normalize(BaseToken* token, u_int64_t limit) {
+    // The pool serves one reduction at a time
+    if (pthread_mutex_trylock(&reduce_lock) != 0) {
+        Reducer reducer;
+        reducer_start(&reducer, retain_token(token), NULL);
+        for (u_int64_t i = 0; i < limit && reducer_step(&reducer); i++);
+        return reducer_finish(&reducer);
+    }
+
+    if (!reduce_pool) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        int threads = cores < 1 ? 1 : cores > PAR_MAX_THREADS ? PAR_MAX_THREADS : (int)cores;
+        reduce_pool = pool_create(threads, free_worker);
+    }
+
+    ParRun run = {0};
+    run.limit = limit;
+    run.epoch = ++reduce_epoch;
+    ParTask* root = par_alloc(sizeof(ParTask));
+    root->term = token;
+    pool_steal(reduce_pool, root, run_task, &run);
+
+    // The workers keep their tokens until the next reduction, the result moves to the arena of the caller
+    BaseToken* result = clone_into(run.result, COMMAND_ARENA);
+    pthread_mutex_unlock(&reduce_lock);
+    return result;
+}
+
+void free_par(void) {
+    pthread_mutex_lock(&reduce_lock);
+    pool_free(reduce_pool);
+    reduce_pool = NULL;
+    pthread_mutex_unlock(&reduce_lock);
+}
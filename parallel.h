@@ -0,0 +1,36 @@
+#ifndef PARALLEL
+#define PARALLEL
+
+#include "lambda_calc.h"
+
+/*Terms smaller than this are reduced by one worker without splitting them up*/
+#define PAR_SERIAL_SIZE 1024
+/*Most worker threads of the parallel reduction*/
+#define PAR_MAX_THREADS 64
+
+/*Subterm normalized by one task, its arguments become tasks of their own once it is in head normal form*/
+typedef struct ParTask {
+    BaseToken* term; // Borrowed from the thread that made it
+    struct ParTask* parent;
+    u_int32_t slot; // Argument of the parent this task normalizes
+    BaseToken* head; // Head normal form the arguments were taken from
+    BaseToken** args; // Normal forms of the arguments, filled in by the children
+    u_int32_t arg_count;
+    u_int32_t pending; // Children still running, the last one rebuilds the term
+} ParTask;
+
+/*State shared by the tasks of one reduction*/
+typedef struct ParRun {
+    u_int64_t limit; // Budget of beta reductions
+    u_int64_t steps; // Reductions done or reserved by a worker
+    size_t epoch; // Number of the reduction, workers release the tokens of older ones
+    BaseToken* result; // Normal form of the root task, made of tokens of the workers
+} ParRun;
+
+/*Normalizes the token in normal order with at most limit reductions, the arguments of every head normal form are reduced at once on a work stealing pool*/
+BaseToken* par_normalize(BaseToken* token, u_int64_t limit);
+
+/*Stops the reduction workers*/
+void free_par(void);
+
+#endif
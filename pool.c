@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include "pool.h"
+
+/*Takes job indices until none are left*/
+static void run_jobs(WorkerPool* pool, PoolJob job, void* data, size_t count) {
+    while (1) {
+        size_t index = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED);
+        if (index >= count) break;
+        job(index, data);
+    }
+}
+
+static void* worker_main(void* arg) {
+    WorkerPool* pool = arg;
+    size_t seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (!pool->stopping && pool->generation == seen) pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->stopping) break;
+        seen = pool->generation;
+        PoolJob job = pool->job;
+        void* data = pool->data;
+        size_t count = pool->count;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_jobs(pool, job, data, count);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0) pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (pool->thread_exit) pool->thread_exit();
+    return NULL;
+}
+
+WorkerPool* pool_create(int thread_count, void (*thread_exit)(void)) {
+    WorkerPool* pool = calloc(1, sizeof(WorkerPool));
+    if (!pool) {
+        perror("Failed to allocate memory for worker pool");
+        exit(EXIT_FAILURE);
+    }
+    pool->threads = calloc(thread_count, sizeof(pthread_t));
+    if (!pool->threads) {
+        perror("Failed to allocate memory for worker pool");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->thread_exit = thread_exit;
+
+    for (int i = 0; i < thread_count; i++) {
+        if (pthread_create(&pool->threads[i], NULL, worker_main, pool) != 0) {
+            perror("Failed to start worker thread");
+            exit(EXIT_FAILURE);
+        }
+        pool->thread_count++;
+    }
+    return pool;
+}
+
+static void start_run(WorkerPool* pool, size_t count, PoolJob job, void* data) {
+    pthread_mutex_lock(&pool->lock);
+    pool->job = job;
+    pool->data = data;
+    pool->count = count;
+    pool->next = 0;
+    pool->busy = pool->thread_count;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void wait_run(WorkerPool* pool) {
+    // Every worker has to leave the run before its jobs and data can be reused
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy > 0) pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_run(WorkerPool* pool, size_t count, PoolJob job, void* data) {
+    if (count == 0) return;
+    start_run(pool, count, job, data);
+    run_jobs(pool, job, data, count);
+    wait_run(pool);
+}
+
+/*Run and deque of the worker inside pool_steal*/
+static __thread StealRun* steal_run;
+static __thread int steal_index;
+
+static void push_deque(StealDeque* deque, void* task) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail == deque->capacity) {
+        // Tasks taken by thieves left room at the front, it is reused before growing
+        if (deque->head > 0) {
+            memmove(deque->tasks, deque->tasks + deque->head, (deque->tail - deque->head) * sizeof(void*));
+            deque->tail -= deque->head;
+            deque->head = 0;
+        } else {
+            deque->capacity = deque->capacity ? deque->capacity * 2 : 64;
+            deque->tasks = realloc(deque->tasks, deque->capacity * sizeof(void*));
+            if (!deque->tasks) {
+                perror("Failed to allocate memory for work deque");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    deque->tasks[deque->tail++] = task;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+static void* take_deque(StealDeque* deque, int own) {
+    void* task = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->head < deque->tail) task = own ? deque->tasks[--deque->tail] : deque->tasks[deque->head++];
+    if (deque->head == deque->tail) deque->head = deque->tail = 0;
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
+
+void steal_push(void* task) {
+    __atomic_add_fetch(&steal_run->pending, 1, __ATOMIC_RELAXED);
+    push_deque(&steal_run->deques[steal_index], task);
+}
+
+static void steal_loop(size_t index, void* data) {
+    StealRun* run = data;
+    steal_run = run;
+    steal_index = index;
+
+    while (1) {
+        // Newest own tasks first, they are small and their data is still in the cache
+        void* task = take_deque(&run->deques[index], 1);
+        for (int i = 1; !task && i < run->deque_count; i++)
+            task = take_deque(&run->deques[(index + i) % run->deque_count], 0);
+
+        if (task) {
+            run->job(task, run->data);
+            __atomic_sub_fetch(&run->pending, 1, __ATOMIC_RELEASE);
+        } else if (__atomic_load_n(&run->pending, __ATOMIC_ACQUIRE) == 0) {
+            break;
+        } else {
+            sched_yield();
+        }
+    }
+    steal_run = NULL;
+}
+
+void pool_steal(WorkerPool* pool, void* task, StealJob job, void* data) {
+    StealRun run = {0};
+    run.deque_count = pool->thread_count;
+    run.deques = calloc(run.deque_count, sizeof(StealDeque));
+    if (!run.deques) {
+        perror("Failed to allocate memory for work deques");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < run.deque_count; i++) pthread_mutex_init(&run.deques[i].lock, NULL);
+    run.job = job;
+    run.data = data;
+    run.pending = 1;
+    push_deque(&run.deques[0], task);
+
+    // Each worker takes one deque, the caller only waits
+    start_run(pool, run.deque_count, steal_loop, &run);
+    wait_run(pool);
+
+    for (int i = 0; i < run.deque_count; i++) {
+        pthread_mutex_destroy(&run.deques[i].lock);
+        free(run.deques[i].tasks);
+    }
+    free(run.deques);
+}
+
+void pool_free(WorkerPool* pool) {
+    if (!pool) return;
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->thread_count; i++) pthread_join(pool->threads[i], NULL);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->threads);
+    free(pool);
+}
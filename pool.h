@@ -0,0 +1,63 @@
+#ifndef POOL
+#define POOL
+
+#include <stddef.h>
+#include <pthread.h>
+
+/*Job of a pool run, called once for every index below the count*/
+typedef void (*PoolJob)(size_t index, void* data);
+
+/*Fixed set of worker threads that run the jobs of one pool_run at a time*/
+typedef struct WorkerPool {
+    pthread_t* threads;
+    int thread_count;
+    pthread_mutex_t lock;
+    pthread_cond_t start; // Signalled when a run begins or the pool stops
+    pthread_cond_t done; // Signalled when the last worker leaves a run
+    PoolJob job;
+    void* data;
+    size_t count; // Jobs of the current run
+    size_t next; // Next job index to take, shared by the workers and the caller
+    size_t generation; // Increased for every run so workers notice a new one
+    int busy; // Workers still inside the current run
+    int stopping;
+    void (*thread_exit)(void); // Called by every worker before it ends, releases its thread local state
+} WorkerPool;
+
+/*Starts the worker threads, the caller of pool_run works as one more*/
+WorkerPool* pool_create(int thread_count, void (*thread_exit)(void));
+
+/*Runs the job for every index from 0 to count - 1 on all threads and returns when they are all done*/
+void pool_run(WorkerPool* pool, size_t count, PoolJob job, void* data);
+
+/*Job of a stealing run, called once for every task pushed during the run*/
+typedef void (*StealJob)(void* task, void* data);
+
+/*Tasks of one worker, the worker takes the newest and thieves take the oldest*/
+typedef struct StealDeque {
+    pthread_mutex_t lock;
+    void** tasks;
+    size_t head; // Oldest task, taken by thieves
+    size_t tail; // One past the newest task, taken by the owner
+    size_t capacity;
+} StealDeque;
+
+/*Work stealing run over the pool, every worker has a deque and steals when its own is empty*/
+typedef struct StealRun {
+    StealDeque* deques;
+    int deque_count;
+    size_t pending; // Tasks pushed and not finished yet, the run ends when it reaches 0
+    StealJob job;
+    void* data;
+} StealRun;
+
+/*Runs the job on the root task and every task the jobs push, only the workers run them while the caller waits*/
+void pool_steal(WorkerPool* pool, void* task, StealJob job, void* data);
+
+/*Adds a task to the deque of the calling worker, only called from a job of pool_steal*/
+void steal_push(void* task);
+
+/*Stops and joins the workers and frees the pool*/
+void pool_free(WorkerPool* pool);
+
+#endif
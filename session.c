@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "session.h"
+
+/*Sessions change between batch lines like definitions, so only the thread running the table commands touches them*/
+static Session* sessions;
+static Session* last;
+
+static const char* stop_names[] = {"normal form", "step limit", "time limit", "memory limit", "step limit or normal form"};
+
+Session* get_session(Symbol name) {
+    for (Session* session = sessions; session; session = session->next) {
+        if (session->name == name) return session;
+    }
+    return NULL;
+}
+
+Session* last_session(void) {
+    return last;
+}
+
+Session* first_session(void) {
+    return sessions;
+}
+
+Session* open_session(Symbol name, int mode) {
+    drop_session(name);
+    Session* session = calloc(1, sizeof(Session));
+    if (!session) {
+        perror("Failed to allocate memory for session");
+        exit(EXIT_FAILURE);
+    }
+    session->name = name;
+    session->mode = mode;
+
+    Session** link = &sessions;
+    while (*link) link = &(*link)->next;
+    *link = session;
+    last = session;
+    return session;
+}
+
+void keep_session(Session* session, BaseToken* term, Budget* budget) {
+    // The term outlives the command like a definition does
+    BaseToken* kept = clone_into(term, TABLE_ARENA);
+    u_int8_t previous = set_active_arena(TABLE_ARENA);
+    free_token(session->term);
+    set_active_arena(previous);
+    session->term = kept;
+    session->steps += budget->taken;
+    session->runs++;
+    session->stop = budget->stop;
+    last = session;
+}
+
+static void free_session(Session* session) {
+    u_int8_t previous = set_active_arena(TABLE_ARENA);
+    free_token(session->term);
+    set_active_arena(previous);
+    free(session);
+}
+
+int drop_session(Symbol name) {
+    for (Session** link = &sessions; *link; link = &(*link)->next) {
+        Session* session = *link;
+        if (session->name != name) continue;
+        *link = session->next;
+        if (last == session) last = NULL;
+        free_session(session);
+        return 1;
+    }
+    return 0;
+}
+
+void free_sessions(void) {
+    while (sessions) {
+        Session* session = sessions;
+        sessions = session->next;
+        free_session(session);
+    }
+    last = NULL;
+}
+
+const char* stop_name(int stop) {
+    return stop_names[stop];
+}
@@ -0,0 +1,44 @@
+#ifndef SESSION
+#define SESSION
+
+#include "lambda_calc.h"
+
+/*Name of the session br --session and br continue use when none is given*/
+#define SESSION_DEFAULT "default"
+
+/*Partly reduced term kept between br commands so it can be reduced further*/
+typedef struct Session {
+    Symbol name;
+    int mode; // Reduction every run of the session uses
+    BaseToken* term; // Table arena token, --delta keeps its literals
+    u_int64_t steps; // Reductions over every run
+    u_int64_t runs;
+    int stop; // Why the last run stopped
+    struct Session* next;
+} Session;
+
+/*Session of the name, NULL when there is none*/
+Session* get_session(Symbol name);
+
+/*Session started or continued last, NULL when there is none*/
+Session* last_session(void);
+
+/*First of the sessions in the order they were started*/
+Session* first_session(void);
+
+/*Starts a session of the name, an older one of the same name is dropped*/
+Session* open_session(Symbol name, int mode);
+
+/*Keeps the term as the state of the session after a run*/
+void keep_session(Session* session, BaseToken* term, Budget* budget);
+
+/*Drops the session of the name, 0 when there is none*/
+int drop_session(Symbol name);
+
+/*Drops every session*/
+void free_sessions(void);
+
+/*Text of a stop reason*/
+const char* stop_name(int stop);
+
+#endif
@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+
+/*Snapshot being built in memory before it is written*/
+typedef struct SnapshotWriter {
+    SnapshotNode* nodes;
+    size_t node_count;
+    size_t node_capacity;
+    SnapshotDef* defs;
+    size_t def_count;
+    size_t def_capacity;
+    char* strings;
+    size_t string_size;
+    size_t string_capacity;
+    PointerMap ids; // Position plus one of every written token
+    PointerMap offsets; // Offset plus one of every written name by symbol, symbols only mean something inside one process
+    BaseToken** stack;
+    size_t stack_count;
+    size_t stack_capacity;
+} SnapshotWriter;
+
+static void* grow_snapshot(void* array, size_t* capacity, size_t size, size_t needed) {
+    if (needed <= *capacity) return array;
+    while (*capacity < needed) *capacity = *capacity ? *capacity * 2 : 256;
+    array = realloc(array, *capacity * size);
+    if (!array) {
+        perror("Failed to allocate memory for snapshot");
+        exit(EXIT_FAILURE);
+    }
+    return array;
+}
+
+static u_int32_t add_string(SnapshotWriter* writer, Symbol symbol) {
+    if (!symbol) return SNAPSHOT_NO_NAME;
+    size_t known = (size_t)pointer_map_get(&writer->offsets, (void*)(uintptr_t)symbol);
+    if (known) return known - 1;
+
+    const char* name = symbol_name(symbol);
+    size_t length = strlen(name) + 1;
+    writer->strings = grow_snapshot(writer->strings, &writer->string_capacity, 1, writer->string_size + length);
+    memcpy(writer->strings + writer->string_size, name, length);
+    size_t offset = writer->string_size;
+    writer->string_size += length;
+    pointer_map_put(&writer->offsets, (void*)(uintptr_t)symbol, (void*)(offset + 1));
+    return offset;
+}
+
+static u_int32_t token_id(SnapshotWriter* writer, BaseToken* token) {
+    return (size_t)pointer_map_get(&writer->ids, token) - 1;
+}
+
+/*Writes the token after its children, shared tokens are written once*/
+static u_int32_t add_token(SnapshotWriter* writer, BaseToken* root) {
+    writer->stack_count = 0;
+    writer->stack = grow_snapshot(writer->stack, &writer->stack_capacity, sizeof(BaseToken*), 1);
+    writer->stack[writer->stack_count++] = root;
+
+    while (writer->stack_count > 0) {
+        BaseToken* token = writer->stack[writer->stack_count - 1];
+        if (pointer_map_get(&writer->ids, token)) {
+            writer->stack_count--;
+            continue;
+        }
+
+        // Children missing from the file go first, the token is looked at again once they are written
+        int missing = 0;
+        for (int i = token->type - 1; i >= 0; i--) {
+            if (pointer_map_get(&writer->ids, token->in_values[i])) continue;
+            writer->stack = grow_snapshot(writer->stack, &writer->stack_capacity, sizeof(BaseToken*), writer->stack_count + 1);
+            writer->stack[writer->stack_count++] = token->in_values[i];
+            missing = 1;
+        }
+        if (missing) continue;
+
+        writer->nodes = grow_snapshot(writer->nodes, &writer->node_capacity, sizeof(SnapshotNode), writer->node_count + 1);
+        SnapshotNode* node = &writer->nodes[writer->node_count];
+        node->type = token->type;
+        node->index = token->index;
+        node->name = add_string(writer, token->symbol);
+        node->in[0] = token->type > 0 ? token_id(writer, token->in_values[0]) : 0;
+        node->in[1] = token->type > 1 ? token_id(writer, token->in_values[1]) : 0;
+        pointer_map_put(&writer->ids, token, (void*)(writer->node_count + 1));
+        writer->node_count++;
+        writer->stack_count--;
+    }
+    return token_id(writer, root);
+}
+
+static void free_writer(SnapshotWriter* writer) {
+    free(writer->nodes);
+    free(writer->defs);
+    free(writer->strings);
+    free(writer->stack);
+    pointer_map_free(&writer->ids);
+    pointer_map_free(&writer->offsets);
+}
+
+int save_snapshot(HashTable* table, const char* filename) {
+    SnapshotWriter writer = {0};
+
+    // Definitions are written in the order they were made so a restore keeps it
+    writer.defs = grow_snapshot(writer.defs, &writer.def_capacity, sizeof(SnapshotDef), table->count);
+    for (size_t i = 0; i < table->count; i++) {
+        writer.defs[i].name = add_string(&writer, table->entries[i]->symbol);
+        writer.defs[i].node = add_token(&writer, table->entries[i]->value);
+    }
+    writer.def_count = table->count;
+
+    SnapshotHeader header = {0};
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.node_count = writer.node_count;
+    header.def_count = writer.def_count;
+    header.string_size = writer.string_size;
+
+    // The image is written next to the file and renamed over it, a reader never sees half of one
+    size_t length = strlen(filename);
+    char* temporary = malloc(length + 5);
+    if (!temporary) {
+        perror("Failed to allocate memory for snapshot");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(temporary, filename, length);
+    memcpy(temporary + length, ".tmp", 5);
+
+    int status = -1;
+    FILE* file = fopen(temporary, "wb");
+    if (file) {
+        int written = writer.node_count < UINT32_MAX && writer.string_size < UINT32_MAX &&
+            fwrite(&header, sizeof(header), 1, file) == 1 &&
+            fwrite(writer.nodes, sizeof(SnapshotNode), writer.node_count, file) == writer.node_count &&
+            fwrite(writer.defs, sizeof(SnapshotDef), writer.def_count, file) == writer.def_count &&
+            fwrite(writer.strings, 1, writer.string_size, file) == writer.string_size;
+        if (fclose(file) == 0 && written && rename(temporary, filename) == 0) status = 0;
+        else unlink(temporary);
+    }
+
+    free(temporary);
+    free_writer(&writer);
+    return status;
+}
+
+/*Checks that every offset and position of the mapped image stays inside it, that varriables and functions have names
+and that every definition is closed*/
+static int valid_snapshot(const char* data, size_t size) {
+    if (size < sizeof(SnapshotHeader)) return 0;
+    const SnapshotHeader* header = (const SnapshotHeader*)data;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0) return 0;
+
+    u_int64_t expected = sizeof(SnapshotHeader) + (u_int64_t)header->node_count * sizeof(SnapshotNode) +
+        (u_int64_t)header->def_count * sizeof(SnapshotDef);
+    if (header->string_size > size || expected != size - header->string_size) return 0;
+    const char* strings = data + expected;
+    if (header->string_size > 0 && strings[header->string_size - 1] != '\0') return 0;
+
+    // Highest index of every node pointing outside of it, like the loose index of its token
+    u_int32_t* loose = malloc(sizeof(u_int32_t) * (header->node_count ? header->node_count : 1));
+    if (!loose) {
+        perror("Failed to allocate memory for snapshot");
+        exit(EXIT_FAILURE);
+    }
+
+    int valid = 1;
+    const SnapshotNode* nodes = (const SnapshotNode*)(data + sizeof(SnapshotHeader));
+    for (u_int32_t i = 0; i < header->node_count && valid; i++) {
+        const SnapshotNode* node = &nodes[i];
+        if (node->type > 2) valid = 0;
+        else if (node->type < 2 && (node->name == SNAPSHOT_NO_NAME || node->name >= header->string_size)) valid = 0;
+        else if (node->type == 2 && node->name != SNAPSHOT_NO_NAME) valid = 0;
+        for (u_int32_t j = 0; j < node->type && valid; j++) if (node->in[j] >= i) valid = 0;
+        if (!valid) break;
+
+        if (node->type == 0) loose[i] = node->index;
+        else if (node->type == 1) loose[i] = loose[node->in[0]] > 0 ? loose[node->in[0]] - 1 : 0;
+        else loose[i] = loose[node->in[0]] > loose[node->in[1]] ? loose[node->in[0]] : loose[node->in[1]];
+    }
+
+    // A definition can't use a varriable bound outside of it
+    const SnapshotDef* defs = (const SnapshotDef*)(nodes + header->node_count);
+    for (u_int32_t i = 0; i < header->def_count && valid; i++) {
+        if (defs[i].name >= header->string_size || defs[i].node >= header->node_count || loose[defs[i].node] != 0) valid = 0;
+    }
+    free(loose);
+    return valid;
+}
+
+int restore_snapshot(HashTable* table, const char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+        close(fd);
+        return -1;
+    }
+    size_t size = info.st_size;
+    char* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return -1;
+    if (!valid_snapshot(data, size)) {
+        munmap(data, size);
+        return -1;
+    }
+
+    const SnapshotHeader* header = (const SnapshotHeader*)data;
+    const SnapshotNode* nodes = (const SnapshotNode*)(data + sizeof(SnapshotHeader));
+    const SnapshotDef* defs = (const SnapshotDef*)(nodes + header->node_count);
+    const char* strings = (const char*)(defs + header->def_count);
+
+    BaseToken** tokens = malloc(sizeof(BaseToken*) * (header->node_count ? header->node_count : 1));
+    // Symbol of every offset, each name of the pool is only interned once
+    Symbol* names = calloc(header->string_size ? header->string_size : 1, sizeof(Symbol));
+    if (!tokens || !names) {
+        perror("Failed to allocate memory for snapshot");
+        exit(EXIT_FAILURE);
+    }
+
+    // Children are always restored before their parents, so one pass in file order makes every token
+    u_int8_t previous = set_active_arena(TABLE_ARENA);
+    for (u_int32_t i = 0; i < header->node_count; i++) {
+        const SnapshotNode* node = &nodes[i];
+        Symbol name = 0;
+        if (node->name != SNAPSHOT_NO_NAME) {
+            if (!names[node->name]) names[node->name] = intern_symbol(strings + node->name, strlen(strings + node->name));
+            name = names[node->name];
+        }
+        if (node->type == 0) tokens[i] = make_var(name, node->index);
+        else if (node->type == 1) tokens[i] = make_function(name, retain_token(tokens[node->in[0]]));
+        else tokens[i] = make_application(retain_token(tokens[node->in[0]]), retain_token(tokens[node->in[1]]));
+    }
+    set_active_arena(previous);
+
+    // The values are already table tokens so storing them only adds a reference
+    for (u_int32_t i = 0; i < header->def_count; i++) {
+        const char* name = strings + defs[i].name;
+        insert_variable(table, intern_symbol(name, strlen(name)), tokens[defs[i].node]);
+    }
+
+    previous = set_active_arena(TABLE_ARENA);
+    for (u_int32_t i = 0; i < header->node_count; i++) free_token(tokens[i]);
+    set_active_arena(previous);
+
+    int count = header->def_count;
+    free(names);
+    free(tokens);
+    munmap(data, size);
+    return count;
+}
@@ -0,0 +1,42 @@
+#ifndef SNAPSHOT
+#define SNAPSHOT
+
+#include <stdint.h>
+#include "lambda_calc.h"
+
+/*First bytes of every snapshot, the last two are the format version*/
+#define SNAPSHOT_MAGIC "LCSNAP01"
+/*Name offset of tokens without a name*/
+#define SNAPSHOT_NO_NAME UINT32_MAX
+
+/*Start of a snapshot, followed by the nodes, the definitions and the string pool
+Every field is in the byte order of the machine that wrote it*/
+typedef struct SnapshotHeader {
+    char magic[8];
+    u_int32_t node_count;
+    u_int32_t def_count;
+    u_int64_t string_size; // Bytes of null terminated names at the end of the file
+} SnapshotHeader;
+
+/*Token of a snapshot, children come before their parents and are referred to by their position*/
+typedef struct SnapshotNode {
+    u_int32_t type;
+    u_int32_t index;
+    u_int32_t name; // Offset in the string pool, SNAPSHOT_NO_NAME for applications
+    u_int32_t in[2]; // Body of a function, function and value of an application
+} SnapshotNode;
+
+/*Definition of a snapshot, restored in file order*/
+typedef struct SnapshotDef {
+    u_int32_t name;
+    u_int32_t node;
+} SnapshotDef;
+
+/*Writes every definition of the table to the file, -1 when it can't be written*/
+int save_snapshot(HashTable* table, const char* filename);
+
+/*Adds the definitions of the mapped snapshot to the table without parsing anything
+Returns the number of definitions or -1 when the file can't be read or isn't a valid snapshot*/
+int restore_snapshot(HashTable* table, const char* filename);
+
+#endif
@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "stats.h"
+
+__thread Stats command_stats;
+int stats_timing;
+
+/*Counters of every flushed command of all threads*/
+static Stats totals;
+static pthread_mutex_t totals_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char* phase_names[PHASE_COUNT] = {"parse", "search", "substitute", "expand", "contract", "machine", "print"};
+
+u_int64_t stats_clock(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (u_int64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+u_int64_t stats_phase(int phase, u_int64_t start) {
+    u_int64_t now = stats_clock();
+    command_stats.phase_ns[phase] += now - start;
+    return now;
+}
+
+void stats_max_size(u_int64_t size) {
+    if (size > command_stats.max_size) command_stats.max_size = size;
+}
+
+void stats_flush(void) {
+    pthread_mutex_lock(&totals_lock);
+    u_int64_t* total = (u_int64_t*)&totals;
+    u_int64_t* counter = (u_int64_t*)&command_stats;
+    // Every field is a sum except the largest size
+    for (size_t i = 0; i < sizeof(Stats) / sizeof(u_int64_t); i++) total[i] += counter[i];
+    totals.max_size -= command_stats.max_size;
+    if (command_stats.max_size > totals.max_size) totals.max_size = command_stats.max_size;
+    pthread_mutex_unlock(&totals_lock);
+    memset(&command_stats, 0, sizeof(Stats));
+}
+
+void stats_end_command(void) {
+    command_stats.commands++;
+    stats_flush();
+}
+
+void stats_totals(Stats* out) {
+    pthread_mutex_lock(&totals_lock);
+    *out = totals;
+    pthread_mutex_unlock(&totals_lock);
+}
+
+void stats_reset(void) {
+    pthread_mutex_lock(&totals_lock);
+    memset(&totals, 0, sizeof(Stats));
+    pthread_mutex_unlock(&totals_lock);
+}
+
+void print_stats(FILE* out, const Stats* stats, int compact) {
+    unsigned long long values[] = {stats->beta_steps, stats->delta_steps, stats->unfolds, stats->substitutions, stats->shifted, stats->cloned,
+        stats->tokens_made, stats->tokens_freed, stats->shared, stats->max_size, stats->search_visits,
+        stats->unique_probes, stats->table_lookups, stats->table_probes, stats->memo_hits, stats->memo_misses};
+    const char* names[] = {"beta steps", "delta steps", "unfolds", "substitutions", "shifted", "cloned", "tokens made", "tokens freed",
+        "shared", "max size", "search visits", "unique probes", "table lookups", "table probes", "memo hits", "memo misses"};
+    size_t count = sizeof(values) / sizeof(values[0]);
+
+    if (compact) {
+        fprintf(out, "stats:");
+        for (size_t i = 0; i < count; i++) fprintf(out, "%s %s %llu", i ? "," : "", names[i], values[i]);
+        fprintf(out, ", ms");
+        for (int i = 0; i < PHASE_COUNT; i++) fprintf(out, " %s %.3f", phase_names[i], stats->phase_ns[i] / 1e6);
+        fprintf(out, "\n");
+        return;
+    }
+
+    fprintf(out, "%-16s %llu\n", "commands", (unsigned long long)stats->commands);
+    for (size_t i = 0; i < count; i++) fprintf(out, "%-16s %llu\n", names[i], values[i]);
+    for (int i = 0; i < PHASE_COUNT; i++) fprintf(out, "%-16s %.3f ms\n", phase_names[i], stats->phase_ns[i] / 1e6);
+}
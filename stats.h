@@ -0,0 +1,71 @@
+#ifndef STATS
+#define STATS
+
+#include <stdio.h>
+#include <sys/types.h>
+
+/*Phases the time of a command is split into*/
+#define PHASE_PARSE 0
+#define PHASE_SEARCH 1 // Looking for the next redex
+#define PHASE_SUBSTITUTE 2 // Replacing the varriable and rebuilding the path down to the redex
+#define PHASE_EXPAND 3
+#define PHASE_CONTRACT 4
+#define PHASE_MACHINE 5 // Environment machine and interaction net
+#define PHASE_PRINT 6
+#define PHASE_COUNT 7
+
+/*Work done by the commands of one thread*/
+typedef struct Stats {
+    u_int64_t commands;
+    u_int64_t beta_steps;
+    u_int64_t delta_steps; // Builtin operations, literals applied to arguments and primitives unfolded by br --delta
+    u_int64_t unfolds; // Definitions unfolded by run when the reduction reached them
+    u_int64_t substitutions; // Varriables replaced by the argument of a redex
+    u_int64_t shifted; // Varriables renumbered while an argument moves under functions
+    u_int64_t cloned; // Tokens copied into another arena
+    u_int64_t tokens_made;
+    u_int64_t tokens_freed;
+    u_int64_t shared; // Tokens found in the unique table instead of made again
+    u_int64_t unique_probes; // Tokens compared while looking in the unique table
+    u_int64_t search_visits; // Tokens visited looking for redexes
+    u_int64_t table_lookups; // Definitions looked up by name or shape
+    u_int64_t table_probes; // Entries compared during those lookups
+    u_int64_t max_size; // Largest term made, counted as a tree
+    u_int64_t memo_hits; // Reductions answered by the normal form cache
+    u_int64_t memo_misses;
+    u_int64_t phase_ns[PHASE_COUNT];
+} Stats;
+
+/*Counters of the running command, the hot paths add to them directly*/
+extern __thread Stats command_stats;
+
+#define STAT_ADD(field, n) (command_stats.field += (n))
+
+/*Set when every reduction step is timed, without it search and substitute stay at 0*/
+extern int stats_timing;
+
+/*Monotonic time in nanoseconds*/
+u_int64_t stats_clock(void);
+
+/*Adds the time since start to the phase and returns the current time so the next phase can start from it*/
+u_int64_t stats_phase(int phase, u_int64_t start);
+
+/*Remembers the size if it is the largest of the command*/
+void stats_max_size(u_int64_t size);
+
+/*Adds the counters of this thread to the totals and clears them*/
+void stats_flush(void);
+
+/*Counts the finished command and flushes its counters*/
+void stats_end_command(void);
+
+/*Copies the totals of everything flushed so far*/
+void stats_totals(Stats* out);
+
+/*Clears the totals*/
+void stats_reset(void);
+
+/*Prints the counters, on a single line when compact*/
+void print_stats(FILE* out, const Stats* stats, int compact);
+
+#endif